@@ -0,0 +1,134 @@
+#include "batch.h"
+
+#include <cerrno>
+#include <exception>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "error.h"
+
+namespace {
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+bool IsDelimiter(char c) {
+    return IsSpace(c) || c == '(' || c == ')' || c == '\'' || c == '"';
+}
+
+void RunForm(Interpreter* interpreter, std::string_view form, std::ostream* out) {
+    try {
+        *out << interpreter->Run(form) << '\n';
+    } catch (const SyntaxError& error) {
+        *out << "SyntaxError: " << error.what() << '\n';
+    } catch (const RuntimeError& error) {
+        *out << "RuntimeError: " << error.what() << '\n';
+    } catch (const NameError& error) {
+        *out << "NameError: " << error.what() << '\n';
+    } catch (const std::exception& error) {
+        // Such as running out of memory; the forms after it still run.
+        *out << "Error: " << error.what() << '\n';
+    }
+}
+
+}  // namespace
+
+std::optional<size_t> FormScanner::Scan(std::string_view text, bool is_end) {
+    std::optional<size_t> end;
+    for (; pos_ < text.size() && !end; ++pos_) {
+        char c = text[pos_];
+        if (in_string_) {
+            if (is_escaped_) {
+                is_escaped_ = false;
+            } else if (c == '\\') {
+                is_escaped_ = true;
+            } else if (c == '"') {
+                in_string_ = false;
+                if (depth_ == 0) {
+                    end = pos_ + 1;
+                }
+            }
+            continue;
+        }
+        if (in_atom_) {
+            if (!IsDelimiter(c)) {
+                continue;
+            }
+            in_atom_ = false;
+            if (depth_ == 0) {
+                end = pos_;
+                break;
+            }
+        }
+        if (IsSpace(c)) {
+            continue;
+        }
+        if (c == '#' && pos_ + 1 == text.size() && !is_end) {
+            // Whether this opens a vector depends on the next character.
+            break;
+        }
+        has_form_ = true;
+        if (c == '(') {
+            ++depth_;
+        } else if (c == '#' && pos_ + 1 < text.size() && text[pos_ + 1] == '(') {
+            ++pos_;
+            ++depth_;
+        } else if (c == ')') {
+            // A stray closing bracket is a form of its own, and an error.
+            if (depth_ == 0 || --depth_ == 0) {
+                end = pos_ + 1;
+            }
+        } else if (c == '"') {
+            in_string_ = true;
+        } else if (c != '\'') {
+            in_atom_ = true;
+        }
+    }
+    if (!end && is_end && has_form_) {
+        end = text.size();
+    }
+    if (end) {
+        *this = FormScanner();
+    }
+    return end;
+}
+
+void RunBatch(Interpreter* interpreter, int fd, std::ostream* out) {
+    std::string buffer;
+    FormScanner scanner;
+    char chunk[1 << 16];
+    while (true) {
+        auto size = read(fd, chunk, sizeof(chunk));
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+        bool is_end = size == 0;
+        buffer.append(chunk, size);
+        std::string_view rest = buffer;
+        while (auto length = scanner.Scan(rest, is_end)) {
+            RunForm(interpreter, rest.substr(0, *length), out);
+            rest.remove_prefix(*length);
+        }
+        // Only the unfinished form is kept between reads.
+        buffer.erase(0, buffer.size() - rest.size());
+        out->flush();
+        if (is_end) {
+            return;
+        }
+    }
+}
+
+void RunBatch(Interpreter* interpreter, std::string_view input, std::ostream* out) {
+    FormScanner scanner;
+    while (auto length = scanner.Scan(input, true)) {
+        RunForm(interpreter, input.substr(0, *length), out);
+        input.remove_prefix(*length);
+    }
+    out->flush();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <ostream>
+#include <string_view>
+
+#include "scheme.h"
+
+// Finds where top-level forms end without parsing them, so that input can be
+// evaluated form by form as it arrives.
+class FormScanner {
+public:
+    // `text` starts where the previous form ended and may only grow between
+    // calls. Returns the length of its first form, or nothing if the form isn't
+    // complete yet. At the end of input an unfinished form counts as complete,
+    // so that its syntax error gets reported.
+    std::optional<size_t> Scan(std::string_view text, bool is_end);
+
+private:
+    size_t pos_ = 0, depth_ = 0;
+    bool in_atom_ = false, in_string_ = false, is_escaped_ = false, has_form_ = false;
+};
+
+// Evaluates every form of the input in order, writing one line per result or
+// error; errors don't stop the rest of the input. Output is flushed whenever
+// the input runs dry and at the end.
+void RunBatch(Interpreter* interpreter, int fd, std::ostream* out);
+void RunBatch(Interpreter* interpreter, std::string_view input, std::ostream* out);
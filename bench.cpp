@@ -0,0 +1,334 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "scheme.h"
+#include "serializer.h"
+#include "tokenizer.h"
+
+// Every allocation made by the process goes through these, so allocations per
+// operation are exact.
+namespace {
+
+std::atomic<size_t> allocations = 0;
+
+void* Allocate(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+    return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return Allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+namespace {
+
+struct Benchmark {
+    std::string name;
+    // Called once before timing starts; returns the operation to time.
+    std::function<std::function<void()>()> setup;
+    // A larger peak RSS fails the run; zero leaves it unchecked.
+    long max_rss_kb = 0;
+};
+
+struct Result {
+    size_t iterations;
+    double ns_per_op, allocs_per_op;
+    long peak_rss_kb;
+};
+
+long PeakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Runs the operation in growing batches until a batch takes at least
+// `min_time` seconds, and reports the last batch.
+Result Measure(const std::function<void()>& operation, double min_time) {
+    using Clock = std::chrono::steady_clock;
+    operation();
+    for (size_t iterations = 1;; iterations *= 2) {
+        size_t allocations_before = allocations.load(std::memory_order_relaxed);
+        auto start = Clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            operation();
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        if (elapsed.count() >= min_time) {
+            size_t allocated = allocations.load(std::memory_order_relaxed) - allocations_before;
+            return {iterations, elapsed.count() * 1e9 / iterations,
+                    static_cast<double>(allocated) / iterations, PeakRssKb()};
+        }
+    }
+}
+
+// Sets up and measures the benchmark in a child process, so that the peak RSS
+// it reports is its own rather than the largest of all that ran before.
+std::optional<Result> MeasureInChild(const Benchmark& benchmark, double min_time) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return std::nullopt;
+    }
+    auto pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        auto result = Measure(benchmark.setup(), min_time);
+        auto is_written = write(fds[1], &result, sizeof(result)) == sizeof(result);
+        _exit(is_written ? 0 : 1);
+    }
+    close(fds[1]);
+    Result result;
+    auto is_read = pid > 0 && read(fds[0], &result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+    int status = 0;
+    if (pid > 0) {
+        waitpid(pid, &status, 0);
+    }
+    if (!is_read || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+std::string FlatList(size_t size) {
+    std::string text = "'(";
+    for (size_t i = 0; i < size; ++i) {
+        text += std::to_string(i % 1000) + (i % 3 ? " " : " sym ");
+    }
+    return text + ")";
+}
+
+std::string DeepList(size_t depth) {
+    return std::string(depth, '(') + std::string(depth, ')');
+}
+
+std::function<void()> Tokenize(std::string text) {
+    return [text = std::move(text)] {
+        Tokenizer tokenizer{std::string_view(text)};
+        while (!tokenizer.IsEnd()) {
+            tokenizer.Next();
+        }
+    };
+}
+
+std::function<void()> Parse(std::string text) {
+    return [text = std::move(text)] {
+        Tokenizer tokenizer{std::string_view(text)};
+        Read(&tokenizer);
+    };
+}
+
+// Runs `program` once, then times `expression` against the same interpreter.
+std::function<std::function<void()>()> RunScheme(std::string program, std::string expression,
+                                                  Engine engine) {
+    return [=] {
+        auto interpreter = std::make_shared<Interpreter>();
+        interpreter->SetEngine(engine);
+        interpreter->RunAll(program);
+        return [interpreter, expression] { interpreter->Run(expression); };
+    };
+}
+
+const char* kFib = "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))";
+
+const char* kAckermann =
+    "(define (ack m n)"
+    "  (if (= m 0) (+ n 1) (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1))))))";
+
+const char* kTak =
+    "(define (tak x y z)"
+    "  (if (not (< y x)) z (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y))))";
+
+const char* kFactorial = "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))";
+
+// Tail calls run in bounded memory, however many of them there are.
+const char* kLoop = "(define (loop n) (if (= n 0) 0 (loop (- n 1))))";
+constexpr long kLoopMaxRssKb = 32 * 1024;
+
+// cons doesn't evaluate its arguments, so cells are filled with set-car!/set-cdr!.
+const char* kBuildList =
+    "(define (prepend x l) (define c (cons 0 0)) (set-car! c x) (set-cdr! c l) c)"
+    "(define (build n acc) (if (= n 0) acc (build (- n 1) (prepend n acc))))";
+
+const char* kSetCar =
+    "(define box '(0))"
+    "(define (bump n) (set-car! box n) (if (= n 0) (car box) (bump (- n 1))))";
+
+const char* kClosures =
+    "(define (make-adder n) (lambda (x) (+ x n)))"
+    "(define (sum-adders i acc) (if (= i 0) acc (sum-adders (- i 1) ((make-adder i) acc))))";
+
+const char* kVectorSum =
+    "(define v (make-vector 1000 1))"
+    "(define (vsum i acc) (if (= i 1000) acc (vsum (+ i 1) (+ acc (vector-ref v i)))))";
+
+// hash-table-set! returns the table, which threads it through the recursion.
+const char* kHashTable =
+    "(define (fill t i) (if (= i 0) t (fill (hash-table-set! t i i) (- i 1))))"
+    "(define table (fill (make-hash-table) 1000))"
+    "(define (lookup i acc) (if (= i 0) acc (lookup (- i 1) (+ acc (hash-table-ref table i)))))";
+
+const char* kStringPort =
+    "(define (report n port)"
+    "  (if (= n 0) (get-output-string port)"
+    "      (report (- n 1) (write-string \";\" (display n port)))))";
+
+// Defines the memoized function afresh on every call, so that each run starts
+// with an empty cache.
+const char* kMemoFib =
+    "(define (memo-fib n)"
+    "  (define-memoized (fib k) (if (< k 2) k (+ (fib (- k 1)) (fib (- k 2)))))"
+    "  (fib n))";
+
+// The day length is folded into a constant when the function is defined.
+const char* kConstants =
+    "(define (seconds days acc)"
+    "  (if (= days 0) acc (seconds (- days 1) (+ acc (* 60 60 24)))))";
+
+// Every use of the macro is expanded once, on the first call.
+const char* kMacros =
+    "(define-syntax my-cond (syntax-rules (else)"
+    "  ((_ (else e ...)) (begin e ...))"
+    "  ((_ (c e ...) clause ...) (if c (begin e ...) (my-cond clause ...)))))"
+    "(define (classify n acc)"
+    "  (my-cond ((= n 0) acc)"
+    "           ((< n 500) (classify (- n 1) (+ acc 1)))"
+    "           (else (classify (- n 1) acc))))";
+
+std::vector<Benchmark> Benchmarks() {
+    std::vector<Benchmark> benchmarks = {
+        {"tokenize/flat-100k", [] { return Tokenize(FlatList(100000)); }},
+        {"read/flat-100k", [] { return Parse(FlatList(100000)); }},
+        {"read/deep-10k", [] { return Parse("'" + DeepList(10000)); }},
+        {"serialize/flat-100k",
+         [] {
+             auto text = FlatList(100000);
+             Tokenizer tokenizer{std::string_view(text)};
+             auto list = Read(&tokenizer);
+             return [list] {
+                 std::ostringstream out;
+                 Serialize(list, &out);
+             };
+         }},
+        {"serialize/build-10k",
+         [] {
+             auto interpreter = std::make_shared<Interpreter>();
+             interpreter->RunAll(kBuildList);
+             interpreter->Run("(define big (build 10000 '()))");
+             return [interpreter] { interpreter->Run("big"); };
+         }},
+    };
+    std::pair<const char*, Engine> engines[] = {{"tree", Engine::TREE_WALKER},
+                                                {"bytecode", Engine::BYTECODE}};
+    for (auto [suffix, engine] : engines) {
+        std::string tag = std::string("/") + suffix;
+        benchmarks.push_back({"run/fib-20" + tag, RunScheme(kFib, "(fib 20)", engine)});
+        benchmarks.push_back({"run/ack-2-9" + tag, RunScheme(kAckermann, "(ack 2 9)", engine)});
+        benchmarks.push_back(
+            {"run/memo-fib-60" + tag, RunScheme(kMemoFib, "(memo-fib 60)", engine)});
+        benchmarks.push_back({"run/tak-12-8-4" + tag, RunScheme(kTak, "(tak 12 8 4)", engine)});
+        benchmarks.push_back({"run/tail-loop-1m" + tag,
+                              RunScheme(kLoop, "(loop 1000000)", engine), kLoopMaxRssKb});
+        benchmarks.push_back(
+            {"run/factorial-500" + tag, RunScheme(kFactorial, "(fact 500)", engine)});
+        benchmarks.push_back(
+            {"run/build-list-1k" + tag, RunScheme(kBuildList, "(build 1000 '())", engine)});
+        benchmarks.push_back({"run/set-car-10k" + tag, RunScheme(kSetCar, "(bump 10000)", engine)});
+        benchmarks.push_back(
+            {"run/closures-1k" + tag, RunScheme(kClosures, "(sum-adders 1000 0)", engine)});
+        benchmarks.push_back(
+            {"run/constants-1k" + tag, RunScheme(kConstants, "(seconds 1000 0)", engine)});
+        benchmarks.push_back(
+            {"run/cond-macro-1k" + tag, RunScheme(kMacros, "(classify 1000 0)", engine)});
+        benchmarks.push_back(
+            {"run/vector-sum-1k" + tag, RunScheme(kVectorSum, "(vsum 0 0)", engine)});
+        benchmarks.push_back(
+            {"run/hash-lookup-1k" + tag, RunScheme(kHashTable, "(lookup 1000 0)", engine)});
+        benchmarks.push_back(
+            {"run/string-port-1k" + tag,
+             RunScheme(kStringPort, "(report 1000 (open-output-string))", engine)});
+    }
+    return benchmarks;
+}
+
+}  // namespace
+
+// Usage: scheme-bench [--min-time=SECONDS] [NAME_FILTER]
+// Prints one JSON document with a result per benchmark. Exits with 1 if a
+// benchmark fails or peaks above its RSS bound.
+int main(int argc, char** argv) {
+    double min_time = 0.2;
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--min-time=")) {
+            min_time = std::stod(std::string(arg.substr(arg.find('=') + 1)));
+        } else {
+            filter = arg;
+        }
+    }
+    std::cout << "{\"benchmarks\": [";
+    bool is_first = true, is_over_bound = false;
+    for (const auto& benchmark : Benchmarks()) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        auto result = MeasureInChild(benchmark, min_time);
+        if (!result) {
+            std::cerr << "scheme-bench: " << benchmark.name << " failed" << std::endl;
+            return 1;
+        }
+        std::cout << (is_first ? "\n" : ",\n") << "  {\"name\": \"" << benchmark.name
+                  << "\", \"iterations\": " << result->iterations
+                  << ", \"ns_per_op\": " << result->ns_per_op
+                  << ", \"allocs_per_op\": " << result->allocs_per_op
+                  << ", \"peak_rss_kb\": " << result->peak_rss_kb << "}" << std::flush;
+        is_first = false;
+        if (benchmark.max_rss_kb && result->peak_rss_kb > benchmark.max_rss_kb) {
+            std::cerr << "scheme-bench: " << benchmark.name << " peaked at "
+                      << result->peak_rss_kb << " kB, above " << benchmark.max_rss_kb << " kB"
+                      << std::endl;
+            is_over_bound = true;
+        }
+    }
+    std::cout << "\n]}" << std::endl;
+    return is_over_bound ? 1 : 0;
+}
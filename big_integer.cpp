@@ -0,0 +1,352 @@
+#include "big_integer.h"
+
+#include <bit>
+#include <span>
+#include <utility>
+
+namespace {
+
+using Limbs = std::vector<uint32_t>;
+using View = std::span<const uint32_t>;
+
+constexpr uint64_t kBase = uint64_t(1) << 32;
+// Schoolbook multiplication is faster while the shorter operand is smaller.
+constexpr size_t kKaratsubaThreshold = 32;
+constexpr uint32_t kDecimalBase = 1000000000;
+constexpr size_t kDecimalDigits = 9;
+
+View Trim(View limbs) {
+    while (!limbs.empty() && !limbs.back()) {
+        limbs = limbs.first(limbs.size() - 1);
+    }
+    return limbs;
+}
+
+void Trim(Limbs* limbs) {
+    while (!limbs->empty() && !limbs->back()) {
+        limbs->pop_back();
+    }
+}
+
+int CompareMagnitudes(View lhs, View rhs) {
+    lhs = Trim(lhs);
+    rhs = Trim(rhs);
+    if (lhs.size() != rhs.size()) {
+        return lhs.size() < rhs.size() ? -1 : 1;
+    }
+    for (size_t i = lhs.size(); i-- > 0;) {
+        if (lhs[i] != rhs[i]) {
+            return lhs[i] < rhs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+Limbs AddMagnitudes(View lhs, View rhs) {
+    if (lhs.size() < rhs.size()) {
+        std::swap(lhs, rhs);
+    }
+    Limbs sum(lhs.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        carry += uint64_t(lhs[i]) + (i < rhs.size() ? rhs[i] : 0);
+        sum[i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    sum.back() = carry;
+    Trim(&sum);
+    return sum;
+}
+
+// The difference must not be negative.
+void SubtractFrom(Limbs* lhs, View rhs) {
+    uint64_t borrow = 0;
+    for (size_t i = 0; i < lhs->size() && (i < rhs.size() || borrow); ++i) {
+        uint64_t diff = uint64_t((*lhs)[i]) - (i < rhs.size() ? rhs[i] : 0) - borrow;
+        (*lhs)[i] = static_cast<uint32_t>(diff);
+        borrow = diff >> 63;
+    }
+    Trim(lhs);
+}
+
+// Adds rhs shifted left by `offset` limbs. The sum must fit into lhs.
+void AddShifted(Limbs* lhs, View rhs, size_t offset) {
+    uint64_t carry = 0;
+    for (size_t i = 0; i < rhs.size() || carry; ++i) {
+        carry += uint64_t((*lhs)[offset + i]) + (i < rhs.size() ? rhs[i] : 0);
+        (*lhs)[offset + i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+}
+
+void MultiplyAddSmall(Limbs* limbs, uint32_t factor, uint32_t addend) {
+    uint64_t carry = addend;
+    for (auto& limb : *limbs) {
+        carry += uint64_t(limb) * factor;
+        limb = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    if (carry) {
+        limbs->push_back(carry);
+    }
+}
+
+// Returns the remainder.
+uint32_t DivideSmall(Limbs* limbs, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = limbs->size(); i-- > 0;) {
+        uint64_t current = (remainder << 32) | (*limbs)[i];
+        (*limbs)[i] = current / divisor;
+        remainder = current % divisor;
+    }
+    Trim(limbs);
+    return remainder;
+}
+
+Limbs MultiplySchoolbook(View lhs, View rhs) {
+    Limbs product(lhs.size() + rhs.size());
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < rhs.size(); ++j) {
+            carry += uint64_t(lhs[i]) * rhs[j] + product[i + j];
+            product[i + j] = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        product[i + rhs.size()] = carry;
+    }
+    Trim(&product);
+    return product;
+}
+
+// Karatsuba: with x = x1 * B + x0, x * y = x1 y1 B^2 + (x1 y0 + x0 y1) B + x0 y0
+// where the middle term is (x0 + x1)(y0 + y1) - x1 y1 - x0 y0, which takes three
+// half-size products instead of four.
+Limbs MultiplyMagnitudes(View lhs, View rhs) {
+    lhs = Trim(lhs);
+    rhs = Trim(rhs);
+    if (lhs.size() < rhs.size()) {
+        std::swap(lhs, rhs);
+    }
+    if (rhs.size() < kKaratsubaThreshold) {
+        return MultiplySchoolbook(lhs, rhs);
+    }
+    size_t half = (lhs.size() + 1) / 2;
+    auto lhs_low = lhs.first(half), lhs_high = lhs.subspan(half);
+    Limbs product(lhs.size() + rhs.size() + 1);
+    if (rhs.size() <= half) {
+        // Too unbalanced to split both: multiply each half of lhs by rhs.
+        AddShifted(&product, MultiplyMagnitudes(lhs_low, rhs), 0);
+        AddShifted(&product, MultiplyMagnitudes(lhs_high, rhs), half);
+    } else {
+        auto rhs_low = rhs.first(half), rhs_high = rhs.subspan(half);
+        auto low = MultiplyMagnitudes(lhs_low, rhs_low);
+        auto high = MultiplyMagnitudes(lhs_high, rhs_high);
+        auto middle = MultiplyMagnitudes(AddMagnitudes(lhs_low, lhs_high),
+                                         AddMagnitudes(rhs_low, rhs_high));
+        SubtractFrom(&middle, low);
+        SubtractFrom(&middle, high);
+        AddShifted(&product, low, 0);
+        AddShifted(&product, middle, half);
+        AddShifted(&product, high, 2 * half);
+    }
+    Trim(&product);
+    return product;
+}
+
+// Long division, Knuth's algorithm D: each quotient limb is estimated from the
+// top limbs of the remainder and the divisor normalized to have its highest bit
+// set, which makes the estimate at most one too large after the correction loop.
+Limbs DivideMagnitudes(View lhs, View rhs) {
+    lhs = Trim(lhs);
+    rhs = Trim(rhs);
+    if (CompareMagnitudes(lhs, rhs) < 0) {
+        return {};
+    }
+    if (rhs.size() == 1) {
+        Limbs quotient(lhs.begin(), lhs.end());
+        DivideSmall(&quotient, rhs[0]);
+        return quotient;
+    }
+    size_t n = rhs.size(), m = lhs.size() - n;
+    int shift = std::countl_zero(rhs.back());
+    auto shifted = [shift](View limbs, size_t i) -> uint32_t {
+        uint64_t high = i < limbs.size() ? uint64_t(limbs[i]) << shift : 0;
+        uint64_t low = i > 0 ? (uint64_t(limbs[i - 1]) << shift) >> 32 : 0;
+        return high | low;
+    };
+    Limbs divisor(n), remainder(lhs.size() + 1), quotient(m + 1);
+    for (size_t i = 0; i < n; ++i) {
+        divisor[i] = shifted(rhs, i);
+    }
+    for (size_t i = 0; i <= lhs.size(); ++i) {
+        remainder[i] = shifted(lhs, i);
+    }
+    for (size_t j = m + 1; j-- > 0;) {
+        uint64_t top = (uint64_t(remainder[j + n]) << 32) | remainder[j + n - 1];
+        uint64_t estimate = top / divisor[n - 1], rest = top % divisor[n - 1];
+        while (estimate >= kBase ||
+               estimate * divisor[n - 2] > ((rest << 32) | remainder[j + n - 2])) {
+            --estimate;
+            rest += divisor[n - 1];
+            if (rest >= kBase) {
+                break;
+            }
+        }
+        uint64_t carry = 0, borrow = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t product = estimate * divisor[i] + carry;
+            carry = product >> 32;
+            uint64_t diff = uint64_t(remainder[i + j]) - static_cast<uint32_t>(product) - borrow;
+            remainder[i + j] = static_cast<uint32_t>(diff);
+            borrow = diff >> 63;
+        }
+        uint64_t diff = uint64_t(remainder[j + n]) - carry - borrow;
+        remainder[j + n] = static_cast<uint32_t>(diff);
+        if (diff >> 63) {
+            // The estimate was one too large: add the divisor back.
+            --estimate;
+            uint64_t sum = 0;
+            for (size_t i = 0; i < n; ++i) {
+                sum += uint64_t(remainder[i + j]) + divisor[i];
+                remainder[i + j] = static_cast<uint32_t>(sum);
+                sum >>= 32;
+            }
+            remainder[j + n] += sum;
+        }
+        quotient[j] = estimate;
+    }
+    Trim(&quotient);
+    return quotient;
+}
+
+}  // namespace
+
+BigInteger::BigInteger(int64_t value) : is_negative_(value < 0) {
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+    while (magnitude) {
+        limbs_.push_back(static_cast<uint32_t>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+BigInteger::BigInteger(Limbs limbs, bool is_negative) : limbs_(std::move(limbs)) {
+    Trim(&limbs_);
+    is_negative_ = is_negative && !limbs_.empty();
+}
+
+BigInteger BigInteger::Parse(std::string_view text) {
+    bool is_negative = false;
+    if (!text.empty() && (text[0] == '+' || text[0] == '-')) {
+        is_negative = text[0] == '-';
+        text.remove_prefix(1);
+    }
+    Limbs limbs;
+    // The first chunk takes the odd digits, every following one is full.
+    size_t chunk = text.size() % kDecimalDigits ? text.size() % kDecimalDigits : kDecimalDigits;
+    while (!text.empty()) {
+        uint32_t value = 0;
+        for (char c : text.substr(0, chunk)) {
+            value = value * 10 + (c - '0');
+        }
+        MultiplyAddSmall(&limbs, kDecimalBase, value);
+        text.remove_prefix(chunk);
+        chunk = kDecimalDigits;
+    }
+    return BigInteger(std::move(limbs), is_negative);
+}
+
+bool BigInteger::FitsInt64() const {
+    if (limbs_.size() > 2) {
+        return false;
+    }
+    uint64_t magnitude = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | limbs_[i];
+    }
+    uint64_t limit = uint64_t(1) << 63;
+    return is_negative_ ? magnitude <= limit : magnitude < limit;
+}
+
+int64_t BigInteger::ToInt64() const {
+    uint64_t magnitude = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | limbs_[i];
+    }
+    return static_cast<int64_t>(is_negative_ ? 0 - magnitude : magnitude);
+}
+
+std::string BigInteger::ToString() const {
+    if (IsZero()) {
+        return "0";
+    }
+    Limbs limbs = limbs_;
+    std::vector<uint32_t> chunks;
+    while (!limbs.empty()) {
+        chunks.push_back(DivideSmall(&limbs, kDecimalBase));
+    }
+    std::string text = is_negative_ ? "-" : "";
+    text += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        auto digits = std::to_string(chunks[i]);
+        text.append(kDecimalDigits - digits.size(), '0');
+        text += digits;
+    }
+    return text;
+}
+
+size_t BigInteger::Hash() const {
+    size_t hash = is_negative_;
+    for (auto limb : limbs_) {
+        hash = hash * 1000003 ^ limb;
+    }
+    return hash;
+}
+
+int BigInteger::Compare(const BigInteger& other) const {
+    if (is_negative_ != other.is_negative_) {
+        return is_negative_ ? -1 : 1;
+    }
+    int order = CompareMagnitudes(limbs_, other.limbs_);
+    return is_negative_ ? -order : order;
+}
+
+BigInteger BigInteger::operator-() const {
+    return BigInteger(limbs_, !is_negative_);
+}
+
+BigInteger BigInteger::Abs() const {
+    return BigInteger(limbs_, false);
+}
+
+BigInteger BigInteger::Add(const BigInteger& lhs, const BigInteger& rhs, bool negate_rhs) {
+    bool is_rhs_negative = rhs.is_negative_ != negate_rhs;
+    if (lhs.is_negative_ == is_rhs_negative) {
+        return BigInteger(AddMagnitudes(lhs.limbs_, rhs.limbs_), lhs.is_negative_);
+    }
+    if (CompareMagnitudes(lhs.limbs_, rhs.limbs_) >= 0) {
+        auto limbs = lhs.limbs_;
+        SubtractFrom(&limbs, rhs.limbs_);
+        return BigInteger(std::move(limbs), lhs.is_negative_);
+    }
+    auto limbs = rhs.limbs_;
+    SubtractFrom(&limbs, lhs.limbs_);
+    return BigInteger(std::move(limbs), is_rhs_negative);
+}
+
+BigInteger operator+(const BigInteger& lhs, const BigInteger& rhs) {
+    return BigInteger::Add(lhs, rhs, false);
+}
+
+BigInteger operator-(const BigInteger& lhs, const BigInteger& rhs) {
+    return BigInteger::Add(lhs, rhs, true);
+}
+
+BigInteger operator*(const BigInteger& lhs, const BigInteger& rhs) {
+    return BigInteger(MultiplyMagnitudes(lhs.limbs_, rhs.limbs_),
+                      lhs.is_negative_ != rhs.is_negative_);
+}
+
+BigInteger operator/(const BigInteger& lhs, const BigInteger& rhs) {
+    return BigInteger(DivideMagnitudes(lhs.limbs_, rhs.limbs_),
+                      lhs.is_negative_ != rhs.is_negative_);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arbitrary-precision integer in sign and magnitude form. The magnitude is
+// kept in 32-bit limbs from the least significant, without leading zeros.
+class BigInteger {
+public:
+    BigInteger() = default;
+    explicit BigInteger(int64_t value);
+    // Parses an optionally signed string of decimal digits.
+    static BigInteger Parse(std::string_view text);
+
+    bool IsZero() const {
+        return limbs_.empty();
+    }
+    bool IsNegative() const {
+        return is_negative_;
+    }
+    bool FitsInt64() const;
+    // Only meaningful if the value fits.
+    int64_t ToInt64() const;
+    std::string ToString() const;
+    // Returns -1, 0 or 1.
+    int Compare(const BigInteger& other) const;
+    size_t Hash() const;
+
+    BigInteger operator-() const;
+    BigInteger Abs() const;
+    friend BigInteger operator+(const BigInteger& lhs, const BigInteger& rhs);
+    friend BigInteger operator-(const BigInteger& lhs, const BigInteger& rhs);
+    friend BigInteger operator*(const BigInteger& lhs, const BigInteger& rhs);
+    // Rounds towards zero. The divisor must not be zero.
+    friend BigInteger operator/(const BigInteger& lhs, const BigInteger& rhs);
+
+private:
+    using Limbs = std::vector<uint32_t>;
+
+    BigInteger(Limbs limbs, bool is_negative);
+    static BigInteger Add(const BigInteger& lhs, const BigInteger& rhs, bool negate_rhs);
+
+    Limbs limbs_;
+    bool is_negative_ = false;
+};
@@ -0,0 +1,287 @@
+#include "compiler.h"
+#include "macro.h"
+
+namespace {
+
+bool IsProperList(std::shared_ptr<Object> list) {
+    while (Is<Cell>(list)) {
+        list = As<Cell>(list)->GetSecond();
+    }
+    return !list;
+}
+
+std::vector<std::shared_ptr<Object>> ListToVector(std::shared_ptr<Object> list) {
+    std::vector<std::shared_ptr<Object>> elements;
+    while (Is<Cell>(list)) {
+        elements.push_back(As<Cell>(list)->GetFirst());
+        list = As<Cell>(list)->GetSecond();
+    }
+    return elements;
+}
+
+class Compiler {
+public:
+    Compiler(const std::shared_ptr<const FrameLayout>& layout, const std::shared_ptr<Scope>& scope)
+        : layout_(layout), scope_(scope), chunk_(std::make_shared<Chunk>()) {
+    }
+
+    std::shared_ptr<const Chunk> CompileBody(
+        const std::vector<std::shared_ptr<Object>>& executables) {
+        for (size_t i = 0; i < executables.size(); ++i) {
+            bool is_last = i + 1 == executables.size();
+            // Only function bodies have a frame that a tail call can replace.
+            CompileExpression(executables[i], is_last && layout_);
+            if (!is_last) {
+                Emit(OpCode::POP);
+            }
+        }
+        Emit(OpCode::RETURN);
+        return chunk_;
+    }
+
+private:
+    uint32_t Here() const {
+        return chunk_->code.size();
+    }
+
+    uint32_t Emit(OpCode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+        chunk_->code.push_back({op, a, b, c});
+        return Here() - 1;
+    }
+
+    uint32_t AddConstant(std::shared_ptr<Object> object) {
+        chunk_->constants.push_back(std::move(object));
+        return chunk_->constants.size() - 1;
+    }
+
+    // The head of the form follows it, so that the VM can tell a form that was
+    // expanded in place since it was compiled.
+    uint32_t AddForm(const std::shared_ptr<Cell>& cell) {
+        auto index = AddConstant(cell);
+        AddConstant(cell->GetFirst());
+        return index;
+    }
+
+    uint32_t AddFunction(std::shared_ptr<IFunction> func) {
+        chunk_->functions.push_back(std::move(func));
+        return chunk_->functions.size() - 1;
+    }
+
+    void CompileExpression(const std::shared_ptr<Object>& expression, bool is_tail) {
+        if (Is<Number>(expression) || Is<String>(expression) || Is<Vector>(expression) ||
+            (Is<Symbol>(expression) && As<Symbol>(expression)->IsBool())) {
+            Emit(OpCode::CONST, AddConstant(expression));
+            return;
+        }
+        if (Is<Symbol>(expression)) {
+            CompileLoad(As<Symbol>(expression));
+            return;
+        }
+        if (Is<Reference>(expression)) {
+            CompileLoad(As<Reference>(expression));
+            return;
+        }
+        if (!Is<Cell>(expression) || !IsProperList(As<Cell>(expression)->GetSecond())) {
+            Emit(OpCode::EVAL, AddConstant(expression));
+            return;
+        }
+        auto cell = As<Cell>(expression);
+        if (Is<Symbol>(cell->GetFirst())) {
+            CompileCall(cell, is_tail);
+        } else {
+            CompileValueCall(cell, is_tail);
+        }
+    }
+
+    void CompileLoad(const std::shared_ptr<Object>& variable) {
+        auto [name, address] = Address(variable);
+        if (address.slot == LexicalAddress::kNoSlot) {
+            Emit(OpCode::LOAD_GLOBAL, AddConstant(name), address.depth);
+        } else {
+            Emit(OpCode::LOAD_LOCAL, AddConstant(name), address.depth, address.slot);
+        }
+    }
+
+    void CompileStore(const std::shared_ptr<Object>& variable) {
+        auto [name, address] = Address(variable);
+        if (address.slot == LexicalAddress::kNoSlot) {
+            Emit(OpCode::STORE_GLOBAL, AddConstant(name), address.depth);
+        } else {
+            Emit(OpCode::STORE_LOCAL, AddConstant(name), address.depth, address.slot);
+        }
+    }
+
+    // A Reference carries its address; symbols left in a function body, such
+    // as those of macro expansions, are resolved here.
+    std::pair<std::shared_ptr<Symbol>, LexicalAddress> Address(
+        const std::shared_ptr<Object>& variable) const {
+        if (auto reference = As<Reference>(variable)) {
+            return {reference->GetName(), reference->GetAddress()};
+        }
+        auto name = As<Symbol>(variable);
+        if (layout_) {
+            return {name, Resolve(*layout_, name.get(), scope_)};
+        }
+        return {name, {0, LexicalAddress::kNoSlot}};
+    }
+
+    void CompileCall(const std::shared_ptr<Cell>& cell, bool is_tail) {
+        auto name = As<Symbol>(cell->GetFirst());
+        auto args = ListToVector(cell->GetSecond());
+        auto func = scope_->FindFunction(name.get());
+        if (func && func->IsMacro()) {
+            cell->Expand(static_cast<Macro*>(func.get()));
+            CompileExpression(cell, is_tail);
+            return;
+        }
+        if (dynamic_cast<IfFunction*>(func.get()) && (args.size() == 2 || args.size() == 3)) {
+            CompileGuarded(cell, func, [&] {
+                CompileExpression(args[0], false);
+                auto jump_to_else = Emit(OpCode::JUMP_IF_FALSE);
+                CompileExpression(args[1], is_tail);
+                auto jump_to_end = Emit(OpCode::JUMP);
+                chunk_->code[jump_to_else].a = Here();
+                if (args.size() == 3) {
+                    CompileExpression(args[2], is_tail);
+                } else {
+                    Emit(OpCode::CONST, AddConstant(nullptr));
+                }
+                chunk_->code[jump_to_end].a = Here();
+            });
+            return;
+        }
+        if (dynamic_cast<BeginFunction*>(func.get()) && !args.empty()) {
+            CompileGuarded(cell, func, [&] {
+                for (size_t i = 0; i < args.size(); ++i) {
+                    bool is_last = i + 1 == args.size();
+                    CompileExpression(args[i], is_last && is_tail);
+                    if (!is_last) {
+                        Emit(OpCode::POP);
+                    }
+                }
+            });
+            return;
+        }
+        if (dynamic_cast<QuoteFunction*>(func.get()) && args.size() == 1) {
+            CompileGuarded(cell, func, [&] { Emit(OpCode::CONST, AddConstant(args[0])); });
+            return;
+        }
+        if (dynamic_cast<SetFunction*>(func.get()) && args.size() == 2 &&
+            (Is<Symbol>(args[0]) || Is<Reference>(args[0]))) {
+            CompileGuarded(cell, func, [&] {
+                CompileExpression(args[1], false);
+                CompileStore(args[0]);
+            });
+            return;
+        }
+        if (dynamic_cast<LambdaFunction*>(func.get()) && IsLambda(args)) {
+            CompileGuarded(cell, func, [&] {
+                ClosureTemplate closure;
+                for (const auto& arg : ListToVector(args[0])) {
+                    closure.args.push_back(As<Symbol>(arg));
+                }
+                closure.executables.assign(args.begin() + 1, args.end());
+                closure.source = As<Cell>(cell->GetSecond());
+                chunk_->closures.push_back(std::move(closure));
+                Emit(OpCode::MAKE_CLOSURE, chunk_->closures.size() - 1);
+            });
+            return;
+        }
+        if (dynamic_cast<ArithmeticFunction*>(func.get()) ||
+            dynamic_cast<ComparisonFunction*>(func.get())) {
+            CompileGuarded(cell, func, [&] {
+                for (const auto& arg : args) {
+                    CompileExpression(arg, false);
+                    Emit(OpCode::CHECK_NUMBER);
+                }
+                Emit(OpCode::APPLY, AddFunction(func), args.size());
+            });
+            return;
+        }
+        if (dynamic_cast<StrictFunction*>(func.get())) {
+            CompileGuarded(cell, func, [&] {
+                for (const auto& arg : args) {
+                    CompileExpression(arg, false);
+                }
+                Emit(OpCode::APPLY, AddFunction(func), args.size());
+            });
+            return;
+        }
+        if (func && !dynamic_cast<UserFunction*>(func.get())) {
+            Emit(OpCode::EVAL, AddConstant(cell));
+            return;
+        }
+        auto prepare = Emit(OpCode::PREPARE_CALL, AddForm(cell), args.size());
+        for (const auto& arg : args) {
+            CompileExpression(arg, false);
+        }
+        Emit(is_tail ? OpCode::TAIL_CALL : OpCode::CALL, 0, args.size());
+        chunk_->code[prepare].c = Here();
+    }
+
+    void CompileValueCall(const std::shared_ptr<Cell>& cell, bool is_tail) {
+        CompileGuarded(cell, nullptr, [&] {
+            auto args = ListToVector(cell->GetSecond());
+            CompileExpression(cell->GetFirst(), false);
+            auto prepare = Emit(OpCode::PREPARE_VALUE_CALL, AddForm(cell), args.size());
+            for (const auto& arg : args) {
+                CompileExpression(arg, false);
+            }
+            Emit(is_tail ? OpCode::TAIL_CALL : OpCode::CALL, 0, args.size());
+            chunk_->code[prepare].c = Here();
+        });
+    }
+
+    // Emits the fast path for a call whose meaning was decided at compile time,
+    // falling back to the tree walker if the assumption no longer holds.
+    template <class F>
+    void CompileGuarded(const std::shared_ptr<Cell>& cell, std::shared_ptr<IFunction> func,
+                        F compile_fast_path) {
+        auto function = func ? AddFunction(func) : Chunk::kNoFunction;
+        auto guard = Emit(OpCode::GUARD, function, AddForm(cell));
+        compile_fast_path();
+        auto jump_to_end = Emit(OpCode::JUMP);
+        chunk_->code[guard].c = Here();
+        Emit(OpCode::EVAL, AddConstant(cell));
+        chunk_->code[jump_to_end].a = Here();
+    }
+
+    static bool IsLambda(const std::vector<std::shared_ptr<Object>>& args) {
+        if (args.size() < 2 || !IsProperList(args[0])) {
+            return false;
+        }
+        for (const auto& arg : ListToVector(args[0])) {
+            if (!Is<Symbol>(arg)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::shared_ptr<const FrameLayout> layout_;
+    std::shared_ptr<Scope> scope_;
+    std::shared_ptr<Chunk> chunk_;
+};
+
+}  // namespace
+
+void Chunk::Trace(Heap* heap) const {
+    for (const auto& constant : constants) {
+        heap->Mark(constant.get());
+    }
+    for (const auto& function : functions) {
+        heap->Mark(function.get());
+    }
+    for (const auto& closure : closures) {
+        for (const auto& executable : closure.executables) {
+            heap->Mark(executable.get());
+        }
+        heap->Mark(closure.source.get());
+    }
+}
+
+std::shared_ptr<const Chunk> Compile(const std::vector<std::shared_ptr<Object>>& executables,
+                                     const std::shared_ptr<const FrameLayout>& layout,
+                                     const std::shared_ptr<Scope>& scope) {
+    return Compiler(layout, scope).CompileBody(executables);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "object.h"
+
+enum class OpCode : uint8_t {
+    CONST,          // push constants[a]
+    LOAD_LOCAL,     // push variable constants[a] from frame b hops up, slot c
+    LOAD_GLOBAL,    // push variable constants[a] looked up by name b hops up
+    STORE_LOCAL,    // set! of constants[a] at (b, c), leaves the value on the stack
+    STORE_GLOBAL,   // set! of constants[a] by name b hops up
+    POP,
+    JUMP,           // pc = a
+    JUMP_IF_FALSE,  // pop, pc = a if the value is #f
+    CHECK_NUMBER,   // fail with "Bad list" unless the top of the stack is a number
+    GUARD,          // pc = c unless constants[b] still names functions[a] and still has
+                    // the head constants[b + 1] it was compiled with
+    PREPARE_CALL,   // resolve the head of call constants[a]; user functions of arity b
+                    // are pushed as callees, anything else, or a form expanded since it
+                    // was compiled, is evaluated from the forms right away and pc = c
+    PREPARE_VALUE_CALL,  // the same for a call whose head value was just computed
+    CALL,           // call the pending callee with the top b values
+    TAIL_CALL,      // the same, replacing the current frame
+    APPLY,          // apply strict builtin functions[a] to the top b values
+    MAKE_CLOSURE,   // push a closure over the current frame for closures[a]
+    EVAL,           // evaluate constants[a] with the tree-walking evaluator
+    RETURN,
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t a = 0, b = 0, c = 0;
+};
+
+struct ClosureTemplate {
+    std::vector<std::shared_ptr<Symbol>> args;
+    std::vector<std::shared_ptr<Object>> executables;
+    // The cell holding the parameters and the body, which keeps the body
+    // prepared for them, see Cell::PrepareBody.
+    std::shared_ptr<Cell> source;
+};
+
+// Compiled form of a function body or a top-level expression.
+struct Chunk {
+    static constexpr uint32_t kNoFunction = static_cast<uint32_t>(-1);
+
+    void Trace(Heap* heap) const;
+
+    std::vector<Instruction> code;
+    std::vector<std::shared_ptr<Object>> constants;
+    std::vector<std::shared_ptr<IFunction>> functions;
+    std::vector<ClosureTemplate> closures;
+};
+
+// Compiles a body to be run in a frame with the given layout, created on top of
+// `scope`. A null layout compiles a top-level form run directly in `scope`.
+// Special forms and builtins are recognised by what their names resolve to in
+// `scope` at compile time; every such assumption is re-checked by a GUARD.
+std::shared_ptr<const Chunk> Compile(const std::vector<std::shared_ptr<Object>>& executables,
+                                     const std::shared_ptr<const FrameLayout>& layout,
+                                     const std::shared_ptr<Scope>& scope);
@@ -0,0 +1,151 @@
+#include "heap.h"
+
+#include <algorithm>
+
+Heap& GetHeap() {
+    static thread_local Heap heap;
+    return heap;
+}
+
+void Heap::Track(std::weak_ptr<HeapObject> object, size_t size) {
+    entries_.push_back({std::move(object), size});
+    allocated_ += size;
+    stats_.live_bytes += size;
+    ++stats_.live_objects;
+}
+
+void Heap::AddRoot(HeapObject* object) {
+    roots_.push_back(object);
+}
+
+void Heap::RemoveRoot(HeapObject* object) {
+    auto it = std::find(roots_.begin(), roots_.end(), object);
+    if (it != roots_.end()) {
+        roots_.erase(it);
+    }
+}
+
+void Heap::Mark(HeapObject* object) {
+    if (!object || object->mark_epoch_ == HeapObject::kPermanent) {
+        return;
+    }
+    if (is_counting_) {
+        if (auto it = references_.find(object); it != references_.end()) {
+            --it->second;
+        }
+        return;
+    }
+    if (object->mark_epoch_ == epoch_) {
+        return;
+    }
+    object->mark_epoch_ = epoch_;
+    gray_.push_back(object);
+}
+
+void Heap::MarkShared(const void* object, long use_count, void (*trace)(const void*, Heap*)) {
+    if (!is_counting_) {
+        trace(object, this);
+        return;
+    }
+    auto [it, is_new] = shared_.try_emplace(object, SharedEntry{use_count, trace});
+    --it->second.references;
+    if (is_new) {
+        trace(object, this);
+    }
+}
+
+bool Heap::NeedsCollection() const {
+    return allocated_ >= threshold_;
+}
+
+void Heap::CollectIfNeeded() {
+    if (NeedsCollection()) {
+        Collect();
+    }
+}
+
+size_t Heap::Prune() {
+    size_t bytes = 0, objects = 0;
+    auto it = std::remove_if(entries_.begin(), entries_.end(), [&](const Entry& entry) {
+        if (!entry.object.expired()) {
+            return false;
+        }
+        bytes += entry.size;
+        ++objects;
+        return true;
+    });
+    entries_.erase(it, entries_.end());
+    stats_.live_bytes -= bytes;
+    stats_.live_objects -= objects;
+    stats_.reclaimed_objects = objects;
+    return bytes;
+}
+
+// Besides the roots, an object is marked when something other than the tracked
+// objects owns it: a native frame, an untracked object or a cache which isn't
+// traced. Taking the references tracked objects trace off each use count
+// leaves those owners.
+const HeapStats& Heap::Collect() {
+    Prune();
+    std::vector<std::shared_ptr<HeapObject>> objects;
+    objects.reserve(entries_.size());
+    for (const auto& entry : entries_) {
+        if (auto object = entry.object.lock()) {
+            references_.emplace(object.get(), object.use_count() - 1);
+            objects.push_back(std::move(object));
+        }
+    }
+    is_counting_ = true;
+    for (const auto& object : objects) {
+        object->Trace(this);
+    }
+    is_counting_ = false;
+    ++epoch_;
+    for (auto* root : roots_) {
+        Mark(root);
+    }
+    for (auto* root : stack_) {
+        Mark(root);
+    }
+    for (const auto& [object, references] : references_) {
+        if (references > 0) {
+            Mark(object);
+        }
+    }
+    for (const auto& [object, entry] : shared_) {
+        if (entry.references > 0) {
+            entry.trace(object, this);
+        }
+    }
+    references_.clear();
+    shared_.clear();
+    while (!gray_.empty()) {
+        auto* object = gray_.back();
+        gray_.pop_back();
+        object->Trace(this);
+    }
+    for (const auto& object : objects) {
+        if (object->mark_epoch_ != epoch_) {
+            object->Release();
+        }
+    }
+    objects.clear();
+    stats_.reclaimed_bytes = Prune();
+    stats_.total_reclaimed_bytes += stats_.reclaimed_bytes;
+    ++stats_.collections;
+    allocated_ = 0;
+    threshold_ = std::max(kMinThreshold, stats_.live_bytes);
+    return stats_;
+}
+
+const HeapStats& Heap::GetStats() const {
+    return stats_;
+}
+
+Heap::RootGuard::RootGuard(HeapObject* object) {
+    GetHeap().stack_.push_back(object);
+}
+
+Heap::RootGuard::~RootGuard() {
+    GetHeap().stack_.pop_back();
+}
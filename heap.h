@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Heap;
+
+// Base of everything the interpreter allocates on the managed heap.
+// Ownership is still expressed with shared_ptr, the collector only finds
+// unreachable cycles and breaks them by dropping their outgoing references.
+// Trace marks every reference the object owns, once each, and nothing else.
+class HeapObject {
+public:
+    virtual ~HeapObject() = default;
+    virtual void Trace(Heap*) {
+    }
+    virtual void Release() {
+    }
+    bool IsPermanent() const {
+        return mark_epoch_ == kPermanent;
+    }
+
+private:
+    friend class Heap;
+    static constexpr uint64_t kPermanent = UINT64_MAX;
+    uint64_t mark_epoch_ = 0;
+};
+
+struct HeapStats {
+    size_t collections = 0;
+    size_t live_objects = 0;
+    size_t live_bytes = 0;
+    size_t reclaimed_objects = 0;
+    size_t reclaimed_bytes = 0;
+    size_t total_reclaimed_bytes = 0;
+};
+
+class Heap {
+public:
+    static constexpr size_t kMinThreshold = 1 << 20;
+
+    // The object is allocated apart from its control block, which the heap
+    // keeps until the next collection, so that its memory goes with its last
+    // owner.
+    template <class T, class... Args>
+    std::shared_ptr<T> Make(Args&&... args) {
+        std::shared_ptr<T> object(new T(std::forward<Args>(args)...));
+        Track(object, sizeof(T));
+        return object;
+    }
+
+    // Allocates an immutable object shared by every heap and every thread. It is
+    // never tracked, traced or released, and holds no references of its own.
+    template <class T, class... Args>
+    static std::shared_ptr<T> MakePermanent(Args&&... args) {
+        auto object = std::make_shared<T>(std::forward<Args>(args)...);
+        object->mark_epoch_ = HeapObject::kPermanent;
+        return object;
+    }
+
+    void AddRoot(HeapObject* object);
+    void RemoveRoot(HeapObject* object);
+    void Mark(HeapObject* object);
+    // Traces an object which isn't on the heap but may be shared by several
+    // heap objects, such as a function body. Each of its owners calls this.
+    template <class T>
+    void MarkShared(const std::shared_ptr<T>& object) {
+        if (object) {
+            MarkShared(object.get(), object.use_count(), [](const void* object, Heap* heap) {
+                static_cast<const T*>(object)->Trace(heap);
+            });
+        }
+    }
+
+    bool NeedsCollection() const;
+    // Any point of the evaluation may collect, since whatever native frames own
+    // is a root.
+    const HeapStats& Collect();
+    // Collects if the heap has grown enough.
+    void CollectIfNeeded();
+    const HeapStats& GetStats() const;
+
+    // Keeps an object alive for the duration of a native evaluation frame.
+    class RootGuard {
+    public:
+        explicit RootGuard(HeapObject* object);
+        ~RootGuard();
+        RootGuard(const RootGuard&) = delete;
+        RootGuard& operator=(const RootGuard&) = delete;
+    };
+
+private:
+    struct Entry {
+        std::weak_ptr<HeapObject> object;
+        size_t size;
+    };
+
+    struct SharedEntry {
+        long references = 0;
+        void (*trace)(const void*, Heap*) = nullptr;
+    };
+
+    void Track(std::weak_ptr<HeapObject> object, size_t size);
+    void MarkShared(const void* object, long use_count, void (*trace)(const void*, Heap*));
+    size_t Prune();
+
+    std::vector<Entry> entries_;
+    std::vector<HeapObject*> roots_, stack_, gray_;
+    uint64_t epoch_ = 0;
+    size_t allocated_ = 0, threshold_ = kMinThreshold;
+    // While counting, Mark and MarkShared take the traced references off these
+    // counts of references rather than marking.
+    bool is_counting_ = false;
+    std::unordered_map<HeapObject*, long> references_;
+    std::unordered_map<const void*, SharedEntry> shared_;
+    HeapStats stats_;
+};
+
+Heap& GetHeap();
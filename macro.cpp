@@ -0,0 +1,436 @@
+#include "macro.h"
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+struct Binding {
+    std::shared_ptr<Object> form;
+    // Variables under an ellipsis are bound once per repetition.
+    bool is_sequence = false;
+    std::vector<Binding> items = {};
+};
+
+using Bindings = std::unordered_map<const Symbol*, Binding>;
+using Renames = std::unordered_map<const Symbol*, std::shared_ptr<Symbol>>;
+
+const std::shared_ptr<Symbol>& Ellipsis() {
+    static const auto kEllipsis = Symbol::Intern("...");
+    return kEllipsis;
+}
+
+// Elements of a possibly improper list and the object ending it.
+struct ListParts {
+    std::vector<std::shared_ptr<Object>> elements;
+    std::shared_ptr<Object> tail;
+};
+
+ListParts Split(std::shared_ptr<Object> list) {
+    ListParts parts;
+    for (; Is<Cell>(list); list = As<Cell>(list)->GetSecond()) {
+        parts.elements.push_back(As<Cell>(list)->GetFirst());
+    }
+    parts.tail = std::move(list);
+    return parts;
+}
+
+std::shared_ptr<Object> MakeList(const std::vector<std::shared_ptr<Object>>& elements,
+                                 std::shared_ptr<Object> tail) {
+    for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+        tail = GetHeap().Make<Cell>(*it, tail);
+    }
+    return tail;
+}
+
+// The ellipsis follows the element it repeats, so it is never first.
+size_t FindEllipsis(const std::vector<std::shared_ptr<Object>>& elements) {
+    for (size_t i = 1; i < elements.size(); ++i) {
+        if (elements[i] == Ellipsis()) {
+            return i;
+        }
+    }
+    return elements.size();
+}
+
+// The new name isn't interned, so no program can spell it, and it goes with
+// the expansions using it: frozen uses expand anew on every call. The number
+// only tells renames apart when printed.
+std::shared_ptr<Symbol> Rename(const Symbol* name) {
+    static std::atomic<uint64_t> counter = 0;
+    return GetHeap().Make<Symbol>(
+        name->GetName() + "." + std::to_string(counter.fetch_add(1, std::memory_order_relaxed)),
+        name);
+}
+
+class Matcher {
+public:
+    explicit Matcher(const std::unordered_set<const Symbol*>& literals) : literals_(literals) {
+    }
+
+    bool Match(const std::shared_ptr<Object>& pattern, const std::shared_ptr<Object>& form,
+               Bindings* bindings) {
+        static const auto kUnderscore = Symbol::Intern("_");
+        if (Is<Symbol>(pattern)) {
+            if (literals_.contains(As<Symbol>(pattern).get())) {
+                return form == pattern;
+            }
+            if (pattern != kUnderscore) {
+                (*bindings)[As<Symbol>(pattern).get()] = {form};
+            }
+            return true;
+        }
+        if (Is<Cell>(pattern)) {
+            return MatchList(Split(pattern), form, bindings);
+        }
+        return pattern ? IsEqual(pattern, form) : !form;
+    }
+
+    void CollectVariables(const std::shared_ptr<Object>& pattern,
+                          std::unordered_set<const Symbol*>* variables) {
+        static const auto kUnderscore = Symbol::Intern("_");
+        if (Is<Symbol>(pattern) && pattern != kUnderscore && pattern != Ellipsis() &&
+            !literals_.contains(As<Symbol>(pattern).get())) {
+            variables->insert(As<Symbol>(pattern).get());
+        }
+        auto rest = pattern;
+        for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+            CollectVariables(As<Cell>(rest)->GetFirst(), variables);
+        }
+        if (rest != pattern) {
+            CollectVariables(rest, variables);
+        }
+    }
+
+private:
+    bool MatchList(const ListParts& pattern, const std::shared_ptr<Object>& form,
+                   Bindings* bindings) {
+        auto ellipsis = FindEllipsis(pattern.elements);
+        if (ellipsis == pattern.elements.size()) {
+            auto rest = form;
+            for (const auto& element : pattern.elements) {
+                if (!Is<Cell>(rest) || !Match(element, As<Cell>(rest)->GetFirst(), bindings)) {
+                    return false;
+                }
+                rest = As<Cell>(rest)->GetSecond();
+            }
+            return pattern.tail ? Match(pattern.tail, rest, bindings) : !rest;
+        }
+        auto parts = Split(form);
+        size_t before = ellipsis - 1, after = pattern.elements.size() - ellipsis - 1;
+        if (parts.elements.size() < before + after || (!pattern.tail && parts.tail)) {
+            return false;
+        }
+        size_t repeated = parts.elements.size() - before - after;
+        for (size_t i = 0; i < before; ++i) {
+            if (!Match(pattern.elements[i], parts.elements[i], bindings)) {
+                return false;
+            }
+        }
+        const auto& repeated_pattern = pattern.elements[ellipsis - 1];
+        std::unordered_set<const Symbol*> variables;
+        CollectVariables(repeated_pattern, &variables);
+        for (auto variable : variables) {
+            (*bindings)[variable] = {nullptr, true, {}};
+        }
+        for (size_t i = 0; i < repeated; ++i) {
+            Bindings item;
+            if (!Match(repeated_pattern, parts.elements[before + i], &item)) {
+                return false;
+            }
+            for (auto variable : variables) {
+                (*bindings)[variable].items.push_back(std::move(item[variable]));
+            }
+        }
+        for (size_t i = 0; i < after; ++i) {
+            if (!Match(pattern.elements[ellipsis + 1 + i], parts.elements[before + repeated + i],
+                       bindings)) {
+                return false;
+            }
+        }
+        return !pattern.tail || Match(pattern.tail, parts.tail, bindings);
+    }
+
+    const std::unordered_set<const Symbol*>& literals_;
+};
+
+// Symbols of the template which aren't pattern variables.
+void CollectTemplateSymbols(const std::shared_ptr<Object>& list, const Bindings& bindings,
+                            std::vector<const Symbol*>* symbols) {
+    auto rest = list;
+    for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+        auto element = As<Cell>(rest)->GetFirst();
+        if (Is<Symbol>(element) && !bindings.contains(As<Symbol>(element).get())) {
+            symbols->push_back(As<Symbol>(element).get());
+        }
+    }
+    if (Is<Symbol>(rest) && !bindings.contains(As<Symbol>(rest).get())) {
+        symbols->push_back(As<Symbol>(rest).get());
+    }
+}
+
+// Parameters a lambda or function definition written in the template binds
+// within itself.
+std::vector<const Symbol*> FindParameters(const std::shared_ptr<Object>& form,
+                                          const Bindings& bindings) {
+    static const auto kLambda = Symbol::Intern("lambda");
+    static const auto kDefine = Symbol::Intern("define");
+    std::vector<const Symbol*> parameters;
+    auto head = As<Cell>(form)->GetFirst();
+    auto rest = As<Cell>(form)->GetSecond();
+    if (!Is<Cell>(rest) || !Is<Symbol>(head) || bindings.contains(As<Symbol>(head).get())) {
+        return parameters;
+    }
+    if (head == kLambda) {
+        CollectTemplateSymbols(As<Cell>(rest)->GetFirst(), bindings, &parameters);
+    } else if (head == kDefine && Is<Cell>(As<Cell>(rest)->GetFirst())) {
+        CollectTemplateSymbols(As<Cell>(As<Cell>(rest)->GetFirst())->GetSecond(), bindings,
+                               &parameters);
+    }
+    return parameters;
+}
+
+// Names the template defines in the body it is expanded into.
+void CollectDefinitions(const std::shared_ptr<Object>& templ,
+                        const std::unordered_set<const Symbol*>& variables,
+                        std::vector<const Symbol*>* definitions) {
+    static const auto kQuote = Symbol::Intern("quote");
+    static const auto kDefine = Symbol::Intern("define");
+    if (!Is<Cell>(templ) || As<Cell>(templ)->GetFirst() == kQuote) {
+        return;
+    }
+    if (As<Cell>(templ)->GetFirst() == kDefine && Is<Cell>(As<Cell>(templ)->GetSecond())) {
+        auto target = As<Cell>(As<Cell>(templ)->GetSecond())->GetFirst();
+        if (Is<Cell>(target)) {
+            target = As<Cell>(target)->GetFirst();
+        }
+        if (Is<Symbol>(target) && !variables.contains(As<Symbol>(target).get())) {
+            definitions->push_back(As<Symbol>(target).get());
+        }
+    }
+    for (auto rest = templ; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+        CollectDefinitions(As<Cell>(rest)->GetFirst(), variables, definitions);
+    }
+}
+
+// Symbols the template uses outside quoted data which its pattern doesn't bind.
+void CollectFreeSymbols(const std::shared_ptr<Object>& templ,
+                        const std::unordered_set<const Symbol*>& variables,
+                        std::unordered_set<const Symbol*>* symbols) {
+    static const auto kQuote = Symbol::Intern("quote");
+    if (Is<Symbol>(templ)) {
+        if (templ != Ellipsis() && !variables.contains(As<Symbol>(templ).get())) {
+            symbols->insert(As<Symbol>(templ).get());
+        }
+        return;
+    }
+    if (!Is<Cell>(templ) || As<Cell>(templ)->GetFirst() == kQuote) {
+        return;
+    }
+    auto rest = templ;
+    for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+        CollectFreeSymbols(As<Cell>(rest)->GetFirst(), variables, symbols);
+    }
+    if (rest != templ) {
+        CollectFreeSymbols(rest, variables, symbols);
+    }
+}
+
+class Instantiator {
+public:
+    explicit Instantiator(const Renames& aliases) : aliases_(aliases) {
+    }
+
+    std::shared_ptr<Object> Instantiate(const std::shared_ptr<Object>& templ,
+                                        const Bindings& bindings, const Renames& renames) {
+        static const auto kQuote = Symbol::Intern("quote");
+        if (Is<Symbol>(templ)) {
+            auto name = As<Symbol>(templ).get();
+            if (auto it = bindings.find(name); it != bindings.end()) {
+                if (it->second.is_sequence) {
+                    throw SyntaxError("Missing ellipsis");
+                }
+                return it->second.form;
+            }
+            if (auto it = renames.find(name); it != renames.end()) {
+                return it->second;
+            }
+            if (auto it = aliases_.find(name); it != aliases_.end() && !is_quoted_) {
+                return it->second;
+            }
+            return templ;
+        }
+        if (!Is<Cell>(templ)) {
+            return templ;
+        }
+        bool is_quoted = is_quoted_;
+        is_quoted_ = is_quoted_ || As<Cell>(templ)->GetFirst() == kQuote;
+        Renames scoped;
+        const Renames* current = &renames;
+        if (auto parameters = FindParameters(templ, bindings); !parameters.empty()) {
+            scoped = renames;
+            for (auto parameter : parameters) {
+                scoped[parameter] = Rename(parameter);
+            }
+            current = &scoped;
+        }
+        auto parts = Split(templ);
+        std::vector<std::shared_ptr<Object>> elements;
+        for (size_t i = 0; i < parts.elements.size(); ++i) {
+            if (i + 1 < parts.elements.size() && parts.elements[i + 1] == Ellipsis()) {
+                InstantiateRepeated(parts.elements[i], bindings, *current, &elements);
+                ++i;
+            } else {
+                elements.push_back(Instantiate(parts.elements[i], bindings, *current));
+            }
+        }
+        auto result = MakeList(elements, Instantiate(parts.tail, bindings, *current));
+        is_quoted_ = is_quoted;
+        return result;
+    }
+
+private:
+    // The element is repeated once per item of the sequences it uses, which
+    // must all be of the same length.
+    void InstantiateRepeated(const std::shared_ptr<Object>& templ, const Bindings& bindings,
+                             const Renames& renames,
+                             std::vector<std::shared_ptr<Object>>* elements) {
+        std::vector<const Symbol*> sequences;
+        CollectSequences(templ, bindings, &sequences);
+        if (sequences.empty()) {
+            throw SyntaxError("Ellipsis without a pattern variable");
+        }
+        size_t count = bindings.at(sequences[0]).items.size();
+        for (auto name : sequences) {
+            if (bindings.at(name).items.size() != count) {
+                throw SyntaxError("Mismatched ellipsis");
+            }
+        }
+        auto item = bindings;
+        for (size_t i = 0; i < count; ++i) {
+            for (auto name : sequences) {
+                item[name] = bindings.at(name).items[i];
+            }
+            elements->push_back(Instantiate(templ, item, renames));
+        }
+    }
+
+    void CollectSequences(const std::shared_ptr<Object>& templ, const Bindings& bindings,
+                          std::vector<const Symbol*>* sequences) {
+        if (Is<Symbol>(templ)) {
+            auto it = bindings.find(As<Symbol>(templ).get());
+            if (it != bindings.end() && it->second.is_sequence) {
+                sequences->push_back(it->first);
+            }
+            return;
+        }
+        auto rest = templ;
+        for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+            CollectSequences(As<Cell>(rest)->GetFirst(), bindings, sequences);
+        }
+        if (rest != templ) {
+            CollectSequences(rest, bindings, sequences);
+        }
+    }
+
+    const Renames& aliases_;
+    bool is_quoted_ = false;
+};
+
+}  // namespace
+
+Macro::Macro(std::shared_ptr<Symbol> keyword, const std::shared_ptr<Object>& spec,
+             const std::shared_ptr<Scope>& scope)
+    : keyword_(std::move(keyword)) {
+    static const auto kSyntaxRules = Symbol::Intern("syntax-rules");
+    MarkMacro();
+    if (!Is<Cell>(spec) || As<Cell>(spec)->GetFirst() != kSyntaxRules ||
+        !Is<Cell>(As<Cell>(spec)->GetSecond())) {
+        throw SyntaxError("Invalid argument");
+    }
+    auto parts = Split(As<Cell>(spec)->GetSecond());
+    auto literals = Split(parts.elements[0]);
+    if (parts.tail || literals.tail) {
+        throw SyntaxError("Invalid argument");
+    }
+    for (const auto& literal : literals.elements) {
+        if (!Is<Symbol>(literal)) {
+            throw SyntaxError("Invalid argument");
+        }
+        literals_.insert(As<Symbol>(literal).get());
+    }
+    Matcher matcher(literals_);
+    std::unordered_set<const Symbol*> free;
+    for (size_t i = 1; i < parts.elements.size(); ++i) {
+        auto rule = Split(parts.elements[i]);
+        if (rule.elements.size() != 2 || rule.tail || !Is<Cell>(rule.elements[0])) {
+            throw SyntaxError("Invalid argument");
+        }
+        std::unordered_set<const Symbol*> variables;
+        matcher.CollectVariables(As<Cell>(rule.elements[0])->GetSecond(), &variables);
+        std::vector<const Symbol*> definitions;
+        CollectDefinitions(rule.elements[1], variables, &definitions);
+        variables.insert(definitions.begin(), definitions.end());
+        CollectFreeSymbols(rule.elements[1], variables, &free);
+        rules_.push_back({rule.elements[0], rule.elements[1], std::move(definitions)});
+    }
+    // Special forms keep their names, which the resolver and the optimizer
+    // recognize. Free variables, and every name in a macro defined inside a
+    // function, still resolve where the macro is used.
+    Renames aliases;
+    for (auto name : free) {
+        auto function = scope->FindFunction(name);
+        if (name == keyword_.get() ||
+            (function && (function->IsMacro() || EvaluatesArguments(function.get())))) {
+            aliases[name] = Rename(name);
+        }
+    }
+    if (scope->SetAliases(keyword_.get(), aliases)) {
+        aliases_ = std::move(aliases);
+    }
+}
+
+std::shared_ptr<Object> Macro::Execute(std::shared_ptr<Object> object,
+                                       std::shared_ptr<Scope> scope) {
+    return ::Evaluate(Expand(GetHeap().Make<Cell>(keyword_, object)), scope);
+}
+
+std::shared_ptr<Object> Macro::ExecuteTail(std::shared_ptr<Object> object,
+                                           std::shared_ptr<Scope> scope, TailCall* tail_call) {
+    return ::EvaluateTail(Expand(GetHeap().Make<Cell>(keyword_, object)), scope, tail_call);
+}
+
+// The keyword position of a pattern is ignored, so any name can stand there.
+std::shared_ptr<Object> Macro::Expand(const std::shared_ptr<Object>& form) {
+    Matcher matcher(literals_);
+    for (const auto& rule : rules_) {
+        Bindings bindings;
+        if (!matcher.Match(As<Cell>(rule.pattern)->GetSecond(), As<Cell>(form)->GetSecond(),
+                           &bindings)) {
+            continue;
+        }
+        Renames renames;
+        for (auto name : rule.definitions) {
+            renames[name] = Rename(name);
+        }
+        return Instantiator(aliases_).Instantiate(rule.templ, bindings, renames);
+    }
+    throw SyntaxError("No syntax rule matches " + keyword_->GetName());
+}
+
+void Macro::Trace(Heap* heap) {
+    heap->Mark(keyword_.get());
+    for (const auto& rule : rules_) {
+        heap->Mark(rule.pattern.get());
+        heap->Mark(rule.templ.get());
+    }
+    for (const auto& [name, alias] : aliases_) {
+        heap->Mark(alias.get());
+    }
+}
+
+void Macro::Release() {
+    rules_.clear();
+    aliases_.clear();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "object.h"
+
+// A macro defined by (syntax-rules (literal...) (pattern template)...). A form
+// using it is replaced by its expansion the first time it is evaluated or
+// compiled, see Cell::Expand. Variables bound by a template are renamed apart
+// in every expansion, so they can't capture the names of the macro's user.
+// Functions a template uses are called through aliases defined in `scope`, so
+// they are the ones defined where the macro is, whatever the user defines.
+class Macro : public IFunction {
+public:
+    Macro(std::shared_ptr<Symbol> keyword, const std::shared_ptr<Object>& spec,
+          const std::shared_ptr<Scope>& scope);
+
+    // Expands the form without replacing it, for uses reached through a value.
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
+                                    std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> ExecuteTail(std::shared_ptr<Object> object,
+                                        std::shared_ptr<Scope> scope,
+                                        TailCall* tail_call) override;
+    // Returns what the whole use `form`, the keyword included, stands for.
+    // Throws SyntaxError if no rule matches.
+    std::shared_ptr<Object> Expand(const std::shared_ptr<Object>& form);
+
+    void Trace(Heap* heap) override;
+    void Release() override;
+
+private:
+    struct Rule {
+        std::shared_ptr<Object> pattern, templ;
+        // Symbols the template defines with define, renamed in the whole
+        // expansion.
+        std::vector<const Symbol*> definitions;
+    };
+
+    std::shared_ptr<Symbol> keyword_;
+    std::unordered_set<const Symbol*> literals_;
+    std::vector<Rule> rules_;
+    std::unordered_map<const Symbol*, std::shared_ptr<Symbol>> aliases_;
+};
@@ -1,12 +1,92 @@
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "batch.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "optimizer.h"
 #include "scheme.h"
 
-int main() {
-    Interpreter interpreter;
+namespace {
+
+int Run(Interpreter* interpreter, bool is_batch, const char* path) {
+    if (is_batch) {
+        std::ios::sync_with_stdio(false);
+        try {
+            if (path) {
+                MappedFile file(path);
+                RunBatch(interpreter, file.GetContents(), &std::cout);
+            } else {
+                RunBatch(interpreter, STDIN_FILENO, &std::cout);
+            }
+        } catch (const std::system_error& error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
     std::string str;
     while (std::getline(std::cin, str)) {
-        std::cout << interpreter.Run(str) << std::endl;
+        std::cout << interpreter->Run(str) << std::endl;
     }
     return 0;
 }
+
+}  // namespace
+
+// Without arguments every line is run as a separate program. With --batch or a
+// file name, forms are read across lines and evaluated as they complete.
+// --metrics=FILE records runtime metrics and writes them to FILE on exit, and
+// --profile=FILE writes the collapsed stacks of a sampling profile.
+// --dump-optimized prints every form the optimizer changes to stderr.
+int main(int argc, char** argv) {
+    Interpreter interpreter;
+    bool is_batch = false;
+    const char* path = nullptr;
+    std::string metrics_path, profile_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--metrics=")) {
+            metrics_path = arg.substr(arg.find('=') + 1);
+            Metrics::SetEnabled(true);
+            continue;
+        }
+        if (arg.starts_with("--profile=")) {
+            profile_path = arg.substr(arg.find('=') + 1);
+            interpreter.StartProfiling();
+            continue;
+        }
+        if (arg == "--dump-optimized") {
+            SetOptimizerDump(&std::cerr);
+            continue;
+        }
+        is_batch = true;
+        if (arg != "--batch") {
+            path = argv[i];
+        }
+    }
+    int status = Run(&interpreter, is_batch, path);
+    interpreter.StopProfiling();
+    if (!metrics_path.empty()) {
+        std::ofstream out(metrics_path);
+        Metrics::WriteSnapshot(&out);
+        if (!out) {
+            std::cerr << "Can't write metrics to " << metrics_path << std::endl;
+            status = 1;
+        }
+    }
+    if (!profile_path.empty()) {
+        std::ofstream out(profile_path);
+        interpreter.WriteProfile(&out);
+        if (!out) {
+            std::cerr << "Can't write the profile to " << profile_path << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
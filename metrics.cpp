@@ -0,0 +1,112 @@
+#include "metrics.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+std::mutex builtins_mutex;
+// Ordered by name so that snapshots are stable.
+std::map<std::string, std::unique_ptr<BuiltinStats>> builtins;
+
+uint64_t Load(const std::atomic<uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+}  // namespace
+
+void Metrics::SetEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Metrics::Reset() {
+    evaluations_.store(0, std::memory_order_relaxed);
+    frames_.store(0, std::memory_order_relaxed);
+    run_nanoseconds_.store(0, std::memory_order_relaxed);
+    for (auto& bucket : run_buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard lock(builtins_mutex);
+    for (auto& [name, stats] : builtins) {
+        stats->calls.store(0, std::memory_order_relaxed);
+        stats->nanoseconds.store(0, std::memory_order_relaxed);
+    }
+}
+
+BuiltinStats* Metrics::GetBuiltinStats(const std::string& name) {
+    std::lock_guard lock(builtins_mutex);
+    auto& stats = builtins[name];
+    if (!stats) {
+        stats = std::make_unique<BuiltinStats>();
+        stats->name = name;
+    }
+    return stats.get();
+}
+
+void Metrics::RecordCall(BuiltinStats* stats, Clock::duration elapsed) {
+    stats->calls.fetch_add(1, std::memory_order_relaxed);
+    stats->nanoseconds.fetch_add(std::chrono::nanoseconds(elapsed).count(),
+                                 std::memory_order_relaxed);
+}
+
+void Metrics::RecordRun(Clock::duration elapsed) {
+    std::chrono::duration<double> seconds = elapsed;
+    size_t bucket = 0;
+    while (bucket < kRunBuckets.size() && seconds.count() > kRunBuckets[bucket]) {
+        ++bucket;
+    }
+    run_buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    run_nanoseconds_.fetch_add(std::chrono::nanoseconds(elapsed).count(),
+                               std::memory_order_relaxed);
+}
+
+RuntimeStats Metrics::GetStats() {
+    RuntimeStats stats{Load(evaluations_), Load(frames_), 0, Load(run_nanoseconds_), {}};
+    for (const auto& bucket : run_buckets_) {
+        stats.runs += Load(bucket);
+    }
+    std::lock_guard lock(builtins_mutex);
+    for (const auto& [name, builtin] : builtins) {
+        stats.builtin_calls.emplace_back(name, Load(builtin->calls));
+    }
+    return stats;
+}
+
+void Metrics::WriteSnapshot(std::ostream* out) {
+    auto counter = [out](const char* name, const char* help) {
+        *out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " counter\n";
+    };
+    counter("scheme_evaluations_total", "Expressions evaluated by the tree walker.");
+    *out << "scheme_evaluations_total " << Load(evaluations_) << '\n';
+    counter("scheme_frames_total", "Scopes created for user function calls.");
+    *out << "scheme_frames_total " << Load(frames_) << '\n';
+    {
+        std::lock_guard lock(builtins_mutex);
+        counter("scheme_builtin_calls_total", "Calls of each builtin function.");
+        for (const auto& [name, stats] : builtins) {
+            *out << "scheme_builtin_calls_total{builtin=\"" << name << "\"} "
+                 << Load(stats->calls) << '\n';
+        }
+        counter("scheme_builtin_seconds_total", "Time spent in each builtin, nested calls too.");
+        for (const auto& [name, stats] : builtins) {
+            *out << "scheme_builtin_seconds_total{builtin=\"" << name << "\"} "
+                 << Load(stats->nanoseconds) * 1e-9 << '\n';
+        }
+    }
+    *out << "# HELP scheme_run_seconds Time to evaluate and print one top-level form.\n"
+         << "# TYPE scheme_run_seconds histogram\n";
+    uint64_t runs = 0;
+    for (size_t i = 0; i < run_buckets_.size(); ++i) {
+        runs += Load(run_buckets_[i]);
+        *out << "scheme_run_seconds_bucket{le=\"";
+        if (i < kRunBuckets.size()) {
+            *out << kRunBuckets[i];
+        } else {
+            *out << "+Inf";
+        }
+        *out << "\"} " << runs << '\n';
+    }
+    *out << "scheme_run_seconds_sum " << Load(run_nanoseconds_) * 1e-9 << '\n'
+         << "scheme_run_seconds_count " << runs << '\n';
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct BuiltinStats {
+    std::string name;
+    std::atomic<uint64_t> calls = 0;
+    // Inclusive: special forms count the evaluation of their arguments too.
+    std::atomic<uint64_t> nanoseconds = 0;
+};
+
+struct RuntimeStats {
+    uint64_t evaluations, frames, runs, run_nanoseconds;
+    std::vector<std::pair<std::string, uint64_t>> builtin_calls;
+};
+
+// Process-wide counters of what the interpreters are doing. Recording is off by
+// default; while it is off every hook costs one relaxed load and a branch.
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static bool IsEnabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+    static void SetEnabled(bool enabled);
+    // Zeroes every counter, keeping the registered builtins.
+    static void Reset();
+
+    static void CountEvaluation() {
+        if (IsCounting()) {
+            evaluations_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    static void CountFrame() {
+        if (IsCounting()) {
+            frames_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // The counters of the builtin with this name, created on first use and
+    // alive until the process exits.
+    static BuiltinStats* GetBuiltinStats(const std::string& name);
+
+    static RuntimeStats GetStats();
+    // Writes every metric in the Prometheus text exposition format.
+    static void WriteSnapshot(std::ostream* out);
+
+    // Times one builtin call. Does nothing for user functions (null stats) or
+    // when recording was off as the call started.
+    class CallTimer {
+    public:
+        explicit CallTimer(BuiltinStats* stats) : stats_(IsCounting() ? stats : nullptr) {
+            if (stats_) {
+                start_ = Clock::now();
+            }
+        }
+        ~CallTimer() {
+            if (stats_) {
+                RecordCall(stats_, Clock::now() - start_);
+            }
+        }
+        CallTimer(const CallTimer&) = delete;
+        CallTimer& operator=(const CallTimer&) = delete;
+
+    private:
+        BuiltinStats* stats_;
+        Clock::time_point start_;
+    };
+
+    // Keeps the thread's evaluations, frames and calls out of the counters
+    // until destroyed, for work the program didn't ask for, such as the calls
+    // the optimizer folds.
+    class Pause {
+    public:
+        Pause() : was_paused_(is_paused_) {
+            is_paused_ = true;
+        }
+        ~Pause() {
+            is_paused_ = was_paused_;
+        }
+        Pause(const Pause&) = delete;
+        Pause& operator=(const Pause&) = delete;
+
+    private:
+        bool was_paused_;
+    };
+
+    // Adds the time spent on one top-level form to the Run latency histogram.
+    class RunTimer {
+    public:
+        RunTimer() : is_enabled_(IsEnabled()) {
+            if (is_enabled_) {
+                start_ = Clock::now();
+            }
+        }
+        ~RunTimer() {
+            if (is_enabled_) {
+                RecordRun(Clock::now() - start_);
+            }
+        }
+        RunTimer(const RunTimer&) = delete;
+        RunTimer& operator=(const RunTimer&) = delete;
+
+    private:
+        bool is_enabled_;
+        Clock::time_point start_;
+    };
+
+private:
+    // Upper bounds of the Run latency buckets, in seconds.
+    static constexpr std::array<double, 8> kRunBuckets = {1e-6, 1e-5, 1e-4, 1e-3,
+                                                          1e-2, 1e-1, 1,    10};
+
+    static bool IsCounting() {
+        return IsEnabled() && !is_paused_;
+    }
+    static void RecordCall(BuiltinStats* stats, Clock::duration elapsed);
+    static void RecordRun(Clock::duration elapsed);
+
+    inline static std::atomic<bool> enabled_ = false;
+    inline static thread_local bool is_paused_ = false;
+    inline static std::atomic<uint64_t> evaluations_ = 0, frames_ = 0;
+    // The last bucket counts runs slower than every bound.
+    inline static std::array<std::atomic<uint64_t>, kRunBuckets.size() + 1> run_buckets_ = {};
+    inline static std::atomic<uint64_t> run_nanoseconds_ = 0;
+};
@@ -1,101 +1,474 @@
 #include "object.h"
+#include "macro.h"
+#include "profiler.h"
+#include "serializer.h"
+#include "vm.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cmath>
+#include <mutex>
+#include <new>
 #include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+std::atomic<uint64_t> definition_epoch = 0;
+
+// Numbers and symbols are never tracked when printed, and may be permanent.
+std::shared_ptr<Object> Alias(std::shared_ptr<Object> value) {
+    if (Is<Cell>(value) || Is<FunctionObject>(value) || Is<Vector>(value) ||
+        Is<HashTable>(value)) {
+        value->MarkAliased();
+    }
+    return value;
+}
+
+// The form with the symbol of every Reference in it, sharing the parts which
+// have none.
+std::shared_ptr<Object> Unresolve(const std::shared_ptr<Object>& form) {
+    if (auto reference = As<Reference>(form)) {
+        return reference->GetName();
+    }
+    if (!Is<Cell>(form)) {
+        return form;
+    }
+    std::vector<std::shared_ptr<Object>> elements;
+    auto rest = form;
+    bool is_changed = false;
+    for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+        elements.push_back(Unresolve(As<Cell>(rest)->GetFirst()));
+        is_changed |= elements.back() != As<Cell>(rest)->GetFirst();
+    }
+    if (!is_changed) {
+        return form;
+    }
+    for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+        rest = GetHeap().Make<Cell>(*it, rest);
+    }
+    return rest;
+}
+
+// Arguments evaluated by native code, rooted so that evaluating the later ones
+// can't collect the earlier ones.
+class EvaluatedArguments : public HeapObject {
+public:
+    void Trace(Heap* heap) override {
+        for (const auto& value : values) {
+            heap->Mark(value.get());
+        }
+    }
+
+    std::vector<std::shared_ptr<Object>> values;
+};
+
+void CheckArgumentCount(std::span<const std::shared_ptr<Object>> args, size_t min, size_t max) {
+    if (args.size() < min || args.size() > max) {
+        throw RuntimeError("Invalid argument count");
+    }
+}
+
+Vector& ToVector(const std::shared_ptr<Object>& object) {
+    if (!Is<Vector>(object)) {
+        throw RuntimeError("Invalid argument");
+    }
+    return static_cast<Vector&>(*object);
+}
+
+HashTable& ToHashTable(const std::shared_ptr<Object>& object) {
+    if (!Is<HashTable>(object)) {
+        throw RuntimeError("Invalid argument");
+    }
+    return static_cast<HashTable&>(*object);
+}
+
+const std::string& ToString(const std::shared_ptr<Object>& object) {
+    if (!Is<String>(object)) {
+        throw RuntimeError("Invalid argument");
+    }
+    return static_cast<const String&>(*object).GetValue();
+}
+
+StringPort& ToStringPort(const std::shared_ptr<Object>& object) {
+    if (!Is<StringPort>(object)) {
+        throw RuntimeError("Invalid argument");
+    }
+    return static_cast<StringPort&>(*object);
+}
+
+size_t ToIndex(const std::shared_ptr<Object>& object, size_t size) {
+    if (!Is<Number>(object)) {
+        throw RuntimeError("Invalid argument");
+    }
+    const auto& number = static_cast<const Number&>(*object);
+    if (!number.IsFixnum() || number.GetValue() < 0 ||
+        static_cast<uint64_t>(number.GetValue()) >= size) {
+        throw RuntimeError("Out of bounds");
+    }
+    return number.GetValue();
+}
+
+// Values that can't change once made.
+bool IsAtom(const std::shared_ptr<Object>& object) {
+    return !object || Is<Number>(object) || Is<Symbol>(object) || Is<String>(object);
+}
+
+// The finalizer of splitmix64, so that nearby keys land in distant slots.
+uint64_t Mix(uint64_t hash) {
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+    return hash ^ (hash >> 31);
+}
+
+uint64_t HashEqv(const Object* object) {
+    if (object && object->GetType() == ObjectType::NUMBER) {
+        const auto& number = static_cast<const Number&>(*object);
+        return Mix(number.IsFixnum() ? number.GetValue() : number.ToBigInteger().Hash());
+    }
+    return Mix(reinterpret_cast<uintptr_t>(object));
+}
+
+// Hashes at most the first kMaxNodes nodes of a structure, so that cyclic
+// keys hash too.
+uint64_t HashEqual(const std::shared_ptr<Object>& object) {
+    static constexpr size_t kMaxNodes = 64;
+    static constexpr uint64_t kCellTag = 1, kVectorTag = 2;
+    uint64_t hash = 0;
+    std::vector<Object*> stack{object.get()};
+    for (size_t nodes = 0; !stack.empty() && nodes < kMaxNodes; ++nodes) {
+        auto node = stack.back();
+        stack.pop_back();
+        if (node && node->GetType() == ObjectType::CELL) {
+            auto cell = static_cast<Cell*>(node);
+            hash = Mix(hash ^ kCellTag);
+            stack.push_back(cell->GetSecond().get());
+            stack.push_back(cell->GetFirst().get());
+        } else if (node && node->GetType() == ObjectType::VECTOR) {
+            const auto& elements = static_cast<Vector*>(node)->GetElements();
+            hash = Mix(hash ^ kVectorTag ^ (elements.size() << 2));
+            for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+                stack.push_back(it->get());
+            }
+        } else if (node && node->GetType() == ObjectType::STRING) {
+            const auto& value = static_cast<String*>(node)->GetValue();
+            hash = Mix(hash ^ std::hash<std::string>()(value));
+        } else {
+            hash = Mix(hash ^ HashEqv(node));
+        }
+    }
+    return hash;
+}
+
+}  // namespace
+
+std::shared_ptr<Symbol> Symbol::Intern(std::string_view name) {
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const {
+            return std::hash<std::string_view>()(name);
+        }
+    };
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::shared_ptr<Symbol>, Hash, std::equal_to<>> table;
+    std::lock_guard lock(mutex);
+    auto it = table.find(name);
+    if (it == table.end()) {
+        std::string key(name);
+        it = table.emplace(key, Heap::MakePermanent<Symbol>(key)).first;
+    }
+    return it->second;
+}
+
+std::shared_ptr<Number> Number::Make(int64_t value) {
+    static constexpr int64_t kMinCached = -1024, kMaxCached = 1024;
+    static const auto kCache = [] {
+        std::vector<std::shared_ptr<Number>> cache;
+        for (auto i = kMinCached; i < kMaxCached; ++i) {
+            cache.push_back(Heap::MakePermanent<Number>(i));
+        }
+        return cache;
+    }();
+    if (value >= kMinCached && value < kMaxCached) {
+        return kCache[value - kMinCached];
+    }
+    return GetHeap().Make<Number>(value);
+}
+
+std::shared_ptr<Number> Number::Make(BigInteger value) {
+    if (value.FitsInt64()) {
+        return Make(value.ToInt64());
+    }
+    return GetHeap().Make<Number>(std::move(value));
+}
+
+const std::shared_ptr<Symbol>& Symbol::True() {
+    static const auto symbol = Intern("#t");
+    return symbol;
+}
+
+const std::shared_ptr<Symbol>& Symbol::False() {
+    static const auto symbol = Intern("#f");
+    return symbol;
+}
+
+void Scope::AddBuiltin(const std::string& name, std::shared_ptr<IFunction> func) {
+    func->SetBuiltinStats(Metrics::GetBuiltinStats(name));
+    functions_[Symbol::Intern(name).get()] = func;
+    definition_epoch.fetch_add(1, std::memory_order_relaxed);
+}
 
 void Scope::CreateGlobalScope() {
-    functions_["+"] = std::make_shared<SumFunction>();
-    functions_["-"] = std::make_shared<SubtractFunction>();
-    functions_["*"] = std::make_shared<MultiplyFunction>();
-    functions_["/"] = std::make_shared<DivideFunction>();
-    functions_["max"] = std::make_shared<MaxFunction>();
-    functions_["min"] = std::make_shared<MinFunction>();
-    functions_["abs"] = std::make_shared<AbsFunction>();
-    functions_["number?"] = std::make_shared<IsNumberFunction>();
-    functions_["quote"] = std::make_shared<QuoteFunction>();
-    functions_["="] = std::make_shared<EqualFunction>();
-    functions_["<"] = std::make_shared<LessFunction>();
-    functions_[">"] = std::make_shared<GreaterFunction>();
-    functions_["<="] = std::make_shared<LessOrEqualFunction>();
-    functions_[">="] = std::make_shared<GreaterOrEqualFunction>();
-    functions_["boolean?"] = std::make_shared<IsBoolFunction>();
-    functions_["and"] = std::make_shared<AndFunction>();
-    functions_["or"] = std::make_shared<OrFunction>();
-    functions_["not"] = std::make_shared<NotFunction>();
-    functions_["null?"] = std::make_shared<IsNullFunction>();
-    functions_["pair?"] = std::make_shared<IsPairFunction>();
-    functions_["list?"] = std::make_shared<IsListFunction>();
-    functions_["symbol?"] = std::make_shared<IsSymbolFunction>();
-    functions_["cons"] = std::make_shared<ConstructPairFunction>();
-    functions_["car"] = std::make_shared<GetFirstElementFunction>();
-    functions_["cdr"] = std::make_shared<GetSecondElementFunction>();
-    functions_["list"] = std::make_shared<ConstructListFunction>();
-    functions_["list-ref"] = std::make_shared<GetElementFunction>();
-    functions_["list-tail"] = std::make_shared<GetTailFunction>();
-    functions_["if"] = std::make_shared<IfFunction>();
-    functions_["define"] = std::make_shared<DefineFunction>();
-    functions_["set!"] = std::make_shared<SetFunction>();
-    functions_["set-car!"] = std::make_shared<SetFirstFunction>();
-    functions_["set-cdr!"] = std::make_shared<SetSecondFunction>();
-    functions_["lambda"] = std::make_shared<LambdaFunction>();
+    AddBuiltin("+", GetHeap().Make<SumFunction>());
+    AddBuiltin("-", GetHeap().Make<SubtractFunction>());
+    AddBuiltin("*", GetHeap().Make<MultiplyFunction>());
+    AddBuiltin("/", GetHeap().Make<DivideFunction>());
+    AddBuiltin("max", GetHeap().Make<MaxFunction>());
+    AddBuiltin("min", GetHeap().Make<MinFunction>());
+    AddBuiltin("abs", GetHeap().Make<AbsFunction>());
+    AddBuiltin("number?", GetHeap().Make<IsNumberFunction>());
+    AddBuiltin("quote", GetHeap().Make<QuoteFunction>());
+    AddBuiltin("=", GetHeap().Make<EqualFunction>());
+    AddBuiltin("<", GetHeap().Make<LessFunction>());
+    AddBuiltin(">", GetHeap().Make<GreaterFunction>());
+    AddBuiltin("<=", GetHeap().Make<LessOrEqualFunction>());
+    AddBuiltin(">=", GetHeap().Make<GreaterOrEqualFunction>());
+    AddBuiltin("boolean?", GetHeap().Make<IsBoolFunction>());
+    AddBuiltin("and", GetHeap().Make<AndFunction>());
+    AddBuiltin("or", GetHeap().Make<OrFunction>());
+    AddBuiltin("not", GetHeap().Make<NotFunction>());
+    AddBuiltin("null?", GetHeap().Make<IsNullFunction>());
+    AddBuiltin("pair?", GetHeap().Make<IsPairFunction>());
+    AddBuiltin("list?", GetHeap().Make<IsListFunction>());
+    AddBuiltin("symbol?", GetHeap().Make<IsSymbolFunction>());
+    AddBuiltin("cons", GetHeap().Make<ConstructPairFunction>());
+    AddBuiltin("car", GetHeap().Make<GetFirstElementFunction>());
+    AddBuiltin("cdr", GetHeap().Make<GetSecondElementFunction>());
+    AddBuiltin("list", GetHeap().Make<ConstructListFunction>());
+    AddBuiltin("list-ref", GetHeap().Make<GetElementFunction>());
+    AddBuiltin("list-tail", GetHeap().Make<GetTailFunction>());
+    AddBuiltin("if", GetHeap().Make<IfFunction>());
+    AddBuiltin("define", GetHeap().Make<DefineFunction>());
+    AddBuiltin("define-memoized", GetHeap().Make<DefineMemoizedFunction>());
+    AddBuiltin("define-syntax", GetHeap().Make<DefineSyntaxFunction>());
+    AddBuiltin("begin", GetHeap().Make<BeginFunction>());
+    AddBuiltin("memo-stats", GetHeap().Make<MemoStatsFunction>());
+    AddBuiltin("set!", GetHeap().Make<SetFunction>());
+    AddBuiltin("set-car!", GetHeap().Make<SetFirstFunction>());
+    AddBuiltin("set-cdr!", GetHeap().Make<SetSecondFunction>());
+    AddBuiltin("lambda", GetHeap().Make<LambdaFunction>());
+    AddBuiltin("vector?", GetHeap().Make<IsVectorFunction>());
+    AddBuiltin("eq?", GetHeap().Make<IsEqFunction>());
+    AddBuiltin("equal?", GetHeap().Make<IsEqualFunction>());
+    AddBuiltin("hash-table?", GetHeap().Make<IsHashTableFunction>());
+    AddBuiltin("make-hash-table", GetHeap().Make<MakeHashTableFunction>());
+    AddBuiltin("hash-table-ref", GetHeap().Make<HashTableRefFunction>());
+    AddBuiltin("hash-table-set!", GetHeap().Make<HashTableSetFunction>());
+    AddBuiltin("hash-table-delete!", GetHeap().Make<HashTableDeleteFunction>());
+    AddBuiltin("hash-table-contains?", GetHeap().Make<HashTableContainsFunction>());
+    AddBuiltin("hash-table-count", GetHeap().Make<HashTableCountFunction>());
+    AddBuiltin("hash-table-keys", GetHeap().Make<HashTableKeysFunction>());
+    AddBuiltin("hash-table-values", GetHeap().Make<HashTableValuesFunction>());
+    AddBuiltin("hash-table->alist", GetHeap().Make<HashTableToAlistFunction>());
+    AddBuiltin("string?", GetHeap().Make<IsStringFunction>());
+    AddBuiltin("string-length", GetHeap().Make<StringLengthFunction>());
+    AddBuiltin("string-append", GetHeap().Make<StringAppendFunction>());
+    AddBuiltin("substring", GetHeap().Make<SubstringFunction>());
+    AddBuiltin("string=?", GetHeap().Make<IsStringEqualFunction>());
+    AddBuiltin("string->symbol", GetHeap().Make<StringToSymbolFunction>());
+    AddBuiltin("symbol->string", GetHeap().Make<SymbolToStringFunction>());
+    AddBuiltin("number->string", GetHeap().Make<NumberToStringFunction>());
+    AddBuiltin("open-output-string", GetHeap().Make<OpenOutputStringFunction>());
+    AddBuiltin("write-string", GetHeap().Make<WriteStringFunction>());
+    AddBuiltin("display", GetHeap().Make<DisplayFunction>());
+    AddBuiltin("get-output-string", GetHeap().Make<GetOutputStringFunction>());
+    AddBuiltin("make-vector", GetHeap().Make<MakeVectorFunction>());
+    AddBuiltin("vector", GetHeap().Make<ConstructVectorFunction>());
+    AddBuiltin("vector-ref", GetHeap().Make<VectorRefFunction>());
+    AddBuiltin("vector-set!", GetHeap().Make<VectorSetFunction>());
+    AddBuiltin("vector-length", GetHeap().Make<VectorLengthFunction>());
+    AddBuiltin("vector->list", GetHeap().Make<VectorToListFunction>());
+    AddBuiltin("list->vector", GetHeap().Make<ListToVectorFunction>());
+    AddBuiltin("gc", GetHeap().Make<GcFunction>());
+    AddBuiltin("gc-stats", GetHeap().Make<GcStatsFunction>());
+    AddBuiltin("runtime-stats", GetHeap().Make<RuntimeStatsFunction>());
     global_scope_ = this->shared_from_this();
 }
 
 std::shared_ptr<Object> Scope::CallFunction(std::shared_ptr<Object> func,
                                             std::shared_ptr<Object> object,
-                                            std::shared_ptr<Scope> scope) {
+                                            std::shared_ptr<Scope> scope, TailCall* tail_call) {
     if (!Is<Symbol>(func) && !Is<FunctionObject>(func)) {
         throw RuntimeError("Invalid function name");
     }
     if (Is<FunctionObject>(func)) {
-        if (object && object->object_scope) {
-            scope = object->object_scope;
-        }
-        return As<FunctionObject>(func)->GetFunction()->Execute(object, scope);
+        return CallFunction(As<FunctionObject>(func)->GetFunction(), object, scope, tail_call);
     }
-    if (functions_.contains(As<Symbol>(func)->GetName())) {
-        if (object && object->object_scope) {
-            scope = object->object_scope;
-        }
-        return functions_[As<Symbol>(func)->GetName()]->Execute(object, scope);
+    auto name = As<Symbol>(func).get();
+    auto function = FindFunction(name);
+    if (!function) {
+        throw NameError("Unknown function: " + name->GetName());
+    }
+    return CallFunction(function, object, scope, tail_call);
+}
+
+std::shared_ptr<Object> Scope::CallFunction(const std::shared_ptr<IFunction>& function,
+                                            std::shared_ptr<Object> object,
+                                            std::shared_ptr<Scope> scope, TailCall* tail_call) {
+    if (object && object->object_scope) {
+        scope = object->object_scope;
+    }
+    Metrics::CallTimer timer(function->GetBuiltinStats());
+    if (tail_call) {
+        return function->ExecuteTail(object, scope, tail_call);
+    }
+    return function->Execute(object, scope);
+}
+
+// Resolved names jump straight to their frame. Frames only fall back to
+// their variables_ map for definitions the resolver could not see, so any
+// such map on the way makes the lookup take the slow path.
+std::shared_ptr<Object>* Scope::FindVariable(const Symbol* name, LexicalAddress address) {
+    auto [depth, slot] = address;
+    auto current = this;
+    for (; depth > 0 && current->variables_.empty(); --depth) {
+        current = current->parent_scope_.get();
+    }
+    if (depth > 0) {
+        return LookupVariable(name);
+    }
+    if (slot == LexicalAddress::kNoSlot) {
+        return current->LookupVariable(name);
+    }
+    if (!current->slots_[slot].bound) {
+        return LookupVariable(name);
     }
-    if (!parent_scope_) {
-        throw NameError("Unknown function: " + As<Symbol>(func)->GetName());
+    return &current->slots_[slot].value;
+}
+
+std::shared_ptr<Object>* Scope::LookupVariable(const Symbol* name) {
+    for (auto current = this; current; current = current->parent_scope_.get()) {
+        if (current->layout_) {
+            auto slot = current->layout_->FindSlot(name);
+            if (slot != LexicalAddress::kNoSlot && current->slots_[slot].bound) {
+                return &current->slots_[slot].value;
+            }
+        }
+        if (auto it = current->variables_.find(name); it != current->variables_.end()) {
+            return &it->second;
+        }
     }
-    return parent_scope_->CallFunction(func, object, scope);
+    return nullptr;
 }
 
-std::shared_ptr<Object> Scope::GetVariable(const std::string& name) {
-    if (variables_.contains(name)) {
-        return variables_[name];
+std::shared_ptr<Object> Scope::GetVariable(const Symbol* name) {
+    if (auto variable = LookupVariable(name)) {
+        return *variable;
     }
-    if (!parent_scope_) {
-        throw NameError("Unknown variable: " + name);
+    throw NameError("Unknown variable: " + name->GetName());
+}
+
+std::shared_ptr<Object> Scope::GetVariable(const Symbol* name, LexicalAddress address) {
+    if (auto variable = FindVariable(name, address)) {
+        return *variable;
     }
-    return parent_scope_->GetVariable(name);
+    throw NameError("Unknown variable: " + name->GetName());
 }
 
-std::shared_ptr<Object> Scope::AddVariable(const std::string& name,
+std::shared_ptr<Object> Scope::AddVariable(const std::shared_ptr<Symbol>& name,
                                            std::shared_ptr<Object> variable) {
-    return variables_[name] = variable;
+    if (layout_) {
+        if (auto slot = layout_->FindSlot(name.get()); slot != LexicalAddress::kNoSlot) {
+            SetSlot(slot, variable);
+            return variable;
+        }
+    }
+    auto [it, is_new] = variables_.try_emplace(name.get());
+    if (is_new) {
+        KeepName(name);
+    }
+    return it->second = variable;
 }
 
-std::shared_ptr<Object> Scope::UpdateVariable(const std::string& name,
+std::shared_ptr<Object> Scope::UpdateVariable(const Symbol* name,
                                               std::shared_ptr<Object> variable) {
-    if (variables_.contains(name)) {
-        return variables_[name] = variable;
+    if (auto current = LookupVariable(name)) {
+        return *current = variable;
     }
-    if (!parent_scope_) {
-        throw NameError("Unknown variable: " + name);
+    throw NameError("Unknown variable: " + name->GetName());
+}
+
+std::shared_ptr<Object> Scope::UpdateVariable(const Symbol* name, LexicalAddress address,
+                                              std::shared_ptr<Object> variable) {
+    if (auto current = FindVariable(name, address)) {
+        return *current = variable;
     }
-    return parent_scope_->UpdateVariable(name, variable);
+    throw NameError("Unknown variable: " + name->GetName());
 }
 
-std::shared_ptr<Object> Scope::AddFunction(const std::string& name,
+void Scope::SetLayout(std::shared_ptr<const FrameLayout> layout) {
+    slots_.resize(layout->slots.size());
+    layout_ = std::move(layout);
+}
+
+void Scope::SetSlot(size_t slot, std::shared_ptr<Object> variable) {
+    slots_[slot] = {std::move(variable), true};
+}
+
+std::shared_ptr<Object> Scope::AddFunction(std::shared_ptr<Symbol> name,
                                            std::shared_ptr<IFunction> func) {
-    functions_[name] = func;
-    global_scope_->all_functions_.insert(name);
-    return std::make_shared<Symbol>(name);
+    if (auto user = dynamic_cast<UserFunction*>(func.get()); user && !user->HasName()) {
+        user->SetName(name->GetOrigin());
+    }
+    auto [it, is_new] = functions_.try_emplace(name.get());
+    if (is_new) {
+        KeepName(name);
+    }
+    it->second = func;
+    name->MarkFunctionName();
+    if (name->IsPermanent()) {
+        global_scope_->all_functions_.insert(name.get());
+    }
+    definition_epoch.fetch_add(1, std::memory_order_relaxed);
+    if (auto it = aliases_.find(name.get()); it != aliases_.end()) {
+        for (const auto& [keyword, alias] : it->second) {
+            AddFunction(alias, func);
+        }
+    }
+    return name;
+}
+
+bool Scope::SetAliases(
+    const Symbol* keyword,
+    const std::unordered_map<const Symbol*, std::shared_ptr<Symbol>>& aliases) {
+    if (global_scope_.get() != this) {
+        return false;
+    }
+    for (auto it = aliases_.begin(); it != aliases_.end();) {
+        if (it->second.erase(keyword) && it->second.empty()) {
+            it = aliases_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (const auto& [name, alias] : aliases) {
+        if (auto func = FindFunction(name)) {
+            AddFunction(alias, func);
+        }
+        aliases_[name][keyword] = alias;
+    }
+    return true;
+}
+
+// Symbols which aren't interned are made by macro expansions. A scope
+// defining one may outlive the expansion.
+void Scope::KeepName(const std::shared_ptr<Symbol>& name) {
+    if (!name->IsPermanent()) {
+        renamed_.push_back(name);
+    }
 }
 
 void Scope::AddParentScope(std::shared_ptr<Scope> parent_scope) {
@@ -103,40 +476,97 @@ void Scope::AddParentScope(std::shared_ptr<Scope> parent_scope) {
     global_scope_ = parent_scope->global_scope_;
 }
 
-std::shared_ptr<IFunction> Scope::GetFunction(const std::string& name) {
-    if (functions_.contains(name)) {
-        return functions_[name];
+std::shared_ptr<IFunction> Scope::GetFunction(const Symbol* name) {
+    if (auto func = FindFunction(name)) {
+        return func;
     }
-    if (!parent_scope_) {
-        throw NameError("Unknown function: " + name);
+    throw NameError("Unknown function: " + name->GetName());
+}
+
+std::shared_ptr<IFunction> Scope::FindFunction(const Symbol* name) {
+    for (auto current = this; current; current = current->parent_scope_.get()) {
+        if (auto it = current->functions_.find(name); it != current->functions_.end()) {
+            return it->second;
+        }
     }
-    return parent_scope_->GetFunction(name);
+    return nullptr;
 }
 
-bool Scope::IsFunctionExists(const std::string& name) {
-    return global_scope_->all_functions_.contains(name);
+bool Scope::IsFunctionExists(const Symbol* name) {
+    if (!name->IsFunctionName()) {
+        return false;
+    }
+    // A symbol which isn't interned is only ever defined by the expansion that
+    // made it, so the mark is as good as the set, which doesn't keep them.
+    return !name->IsPermanent() || global_scope_->all_functions_.contains(name);
 }
 
-std::shared_ptr<Symbol> BoolToSymbol(bool statement) {
-    if (statement) {
-        return std::make_shared<Symbol>("#t");
+Scope* Scope::GetFunctionScope() {
+    auto current = this;
+    while (current->functions_.empty() && current->parent_scope_) {
+        current = current->parent_scope_.get();
     }
-    return std::make_shared<Symbol>("#f");
+    return current;
 }
 
-bool ObjectToBool(std::shared_ptr<Object> object) {
-    if (!Is<Symbol>(object) || As<Symbol>(object)->GetName() != "#f") {
-        return true;
+uint64_t Scope::GetDefinitionEpoch() {
+    return definition_epoch.load(std::memory_order_relaxed);
+}
+
+void Scope::Trace(Heap* heap) {
+    for (const auto& [name, variable] : variables_) {
+        heap->Mark(variable.get());
+    }
+    for (const auto& [name, func] : functions_) {
+        heap->Mark(func.get());
+    }
+    for (const auto& slot : slots_) {
+        heap->Mark(slot.value.get());
+    }
+    for (const auto& name : renamed_) {
+        heap->Mark(name.get());
+    }
+    for (const auto& [name, aliases] : aliases_) {
+        for (const auto& [keyword, alias] : aliases) {
+            heap->Mark(alias.get());
+        }
     }
-    return false;
+    heap->Mark(parent_scope_.get());
+    heap->Mark(global_scope_.get());
+}
+
+void Scope::Release() {
+    slots_.clear();
+    variables_.clear();
+    functions_.clear();
+    renamed_.clear();
+    aliases_.clear();
+    parent_scope_.reset();
+    global_scope_.reset();
+}
+
+void Object::Trace(Heap* heap) {
+    heap->Mark(object_scope.get());
+}
+
+void Object::Release() {
+    object_scope.reset();
+}
+
+std::shared_ptr<Symbol> BoolToSymbol(bool statement) {
+    return statement ? Symbol::True() : Symbol::False();
+}
+
+bool ObjectToBool(const std::shared_ptr<Object>& object) {
+    return object != Symbol::False();
 };
 
-bool IsBool(std::shared_ptr<Object> object) {
-    return Is<Symbol>(object) &&
-           (As<Symbol>(object)->GetName() == "#t" || As<Symbol>(object)->GetName() == "#f");
+bool IsBool(const std::shared_ptr<Object>& object) {
+    return object == Symbol::True() || object == Symbol::False();
 }
 
 std::shared_ptr<Object> Evaluate(std::shared_ptr<Object> object, std::shared_ptr<Scope> scope) {
+    Metrics::CountEvaluation();
     if (object) {
         if (object->object_scope) {
             scope = object->object_scope;
@@ -146,8 +576,45 @@ std::shared_ptr<Object> Evaluate(std::shared_ptr<Object> object, std::shared_ptr
     throw RuntimeError("Bad list");
 }
 
-std::shared_ptr<Object> UserFunction::Execute(std::shared_ptr<Object> object,
-                                              std::shared_ptr<Scope> scope) {
+std::shared_ptr<Object> EvaluateTail(std::shared_ptr<Object> object, std::shared_ptr<Scope> scope,
+                                     TailCall* tail_call) {
+    Metrics::CountEvaluation();
+    if (object) {
+        if (object->object_scope) {
+            scope = object->object_scope;
+        }
+        return object->EvaluateTail(scope, tail_call);
+    }
+    throw RuntimeError("Bad list");
+}
+
+FunctionBody::FunctionBody(std::vector<std::shared_ptr<Symbol>> args,
+                           std::vector<std::shared_ptr<Object>> source,
+                           const std::shared_ptr<Scope>& parent_scope)
+    : args(std::move(args)), source(std::move(source)) {
+    executables = OptimizeBody(this->source, parent_scope, &folded);
+    layout = ResolveFunction(this->args, &executables, parent_scope);
+}
+
+void FunctionBody::Trace(Heap* heap) const {
+    for (const auto& arg : args) {
+        heap->Mark(arg.get());
+    }
+    for (const auto& executable : executables) {
+        heap->Mark(executable.get());
+    }
+    for (const auto& form : source) {
+        heap->Mark(form.get());
+    }
+    for (const auto& [name, function] : folded) {
+        heap->Mark(function.get());
+    }
+    heap->MarkShared(chunk);
+}
+
+std::shared_ptr<Scope> UserFunction::BindArguments(std::shared_ptr<Object> object,
+                                                   std::shared_ptr<Scope> scope,
+                                                   std::vector<std::shared_ptr<Object>>* values) {
     std::vector<std::shared_ptr<Object>> input_args;
     while (object) {
         if (!Is<Cell>(object)) {
@@ -156,27 +623,385 @@ std::shared_ptr<Object> UserFunction::Execute(std::shared_ptr<Object> object,
         input_args.push_back(As<Cell>(object)->GetFirst());
         object = As<Cell>(object)->GetSecond();
     }
-    if (input_args.size() != args_.size()) {
+    if (input_args.size() != body_->args.size()) {
         throw RuntimeError("Invalid argument count");
     }
 
-    auto new_scope = std::make_shared<Scope>();
-    new_scope->AddParentScope(parent_scope_);
+    auto new_scope = CreateFrame();
+    Heap::RootGuard function_guard(this), scope_guard(new_scope.get()),
+        caller_guard(scope.get());
+    const auto& arg_slots = new_scope->GetLayout()->arg_slots;
+    for (size_t i = 0; i < input_args.size(); ++i) {
+        auto value = Evaluate(input_args[i], scope);
+        if (values) {
+            values->push_back(value);
+        }
+        new_scope->SetSlot(arg_slots[i], std::move(value));
+    }
+    return new_scope;
+}
 
-    for (size_t i = 0; i < args_.size(); ++i) {
-        new_scope->AddVariable(args_[i], Evaluate(input_args[i], scope));
+// Calls in tail position are made by the loop below rather than by nested
+// Execute calls. The result is stamped with the frame of the outermost call,
+// just as the chain of nested calls would have left it.
+std::shared_ptr<Object> UserFunction::Execute(std::shared_ptr<Object> object,
+                                              std::shared_ptr<Scope> scope) {
+    std::vector<std::shared_ptr<Object>> memo_key;
+    auto result_scope = BindArguments(object, scope, memo_ ? &memo_key : nullptr);
+    if (memo_) {
+        if (auto result = FindMemoized(memo_key)) {
+            return result;
+        }
     }
-    for (size_t i = 0; i + 1 < executables_.size(); ++i) {
-        Evaluate(executables_[i], new_scope);
+    Heap::RootGuard result_guard(result_scope.get());
+    Profiler::Frame profiler_frame(GetName());
+    std::shared_ptr<Object> ans;
+    if (auto vm = Vm::Current()) {
+        Heap::RootGuard function_guard(this);
+        ans = vm->Run(GetChunk(), result_scope);
+    } else {
+        auto function = std::static_pointer_cast<UserFunction>(shared_from_this());
+        auto frame = result_scope;
+        while (true) {
+            GetHeap().CollectIfNeeded();
+            Heap::RootGuard function_guard(function.get()), frame_guard(frame.get());
+            // A definition made by the body can have it prepared again.
+            auto body = function->GetBody();
+            const auto& executables = body->executables;
+            for (size_t i = 0; i + 1 < executables.size(); ++i) {
+                Evaluate(executables[i], frame);
+            }
+            TailCall tail_call;
+            ans = EvaluateTail(executables.back(), frame, &tail_call);
+            if (!tail_call.function) {
+                break;
+            }
+            Heap::RootGuard callee_guard(tail_call.function.get());
+            frame = tail_call.function->BindArguments(tail_call.args, tail_call.scope);
+            function = std::move(tail_call.function);
+            profiler_frame.Replace(function->GetName());
+        }
+    }
+    if (Is<Cell>(ans)) {
+        ans->object_scope = result_scope;
+    }
+    if (memo_) {
+        StoreMemoized(memo_key, ans);
     }
-    auto ans = Evaluate(executables_.back(), new_scope);
-    ans->object_scope = new_scope;
     return ans;
 }
 
+std::shared_ptr<Object> UserFunction::ExecuteTail(std::shared_ptr<Object> object,
+                                                  std::shared_ptr<Scope> scope,
+                                                  TailCall* tail_call) {
+    // A memoized call has to finish here to store its result.
+    if (memo_) {
+        return Execute(object, scope);
+    }
+    *tail_call = {std::static_pointer_cast<UserFunction>(shared_from_this()), object, scope};
+    return nullptr;
+}
+
+struct UserFunction::Memo {
+    using Args = std::span<const std::shared_ptr<Object>>;
+
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(Args args) const {
+            uint64_t hash = args.size();
+            for (const auto& arg : args) {
+                hash = Mix(hash ^ HashEqual(arg));
+            }
+            return hash;
+        }
+    };
+
+    struct Equal {
+        using is_transparent = void;
+        bool operator()(Args lhs, Args rhs) const {
+            return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), IsEqual);
+        }
+    };
+
+    // What a name called by the body, or by a function it calls, resolved to
+    // when the results were started.
+    struct Callee {
+        std::weak_ptr<Scope> scope;
+        const Symbol* name;
+        std::weak_ptr<IFunction> function;
+    };
+
+    // Past this many results the cache starts over, which bounds its memory.
+    static constexpr size_t kMaxResults = 1 << 16;
+
+    void RecordCallees(UserFunction* function);
+    // Whether every callee recorded still resolves to the same function.
+    bool HasSameCallees() const;
+
+    uint64_t epoch = std::numeric_limits<uint64_t>::max();
+    std::vector<Callee> callees;
+    std::unordered_map<std::vector<std::shared_ptr<Object>>, std::shared_ptr<Object>, Hash, Equal>
+        results;
+    size_t hits = 0, misses = 0;
+};
+
+void UserFunction::Memo::RecordCallees(UserFunction* function) {
+    static const auto kQuote = Symbol::Intern("quote");
+    callees.clear();
+    std::unordered_set<UserFunction*> visited;
+    std::vector<UserFunction*> functions{function};
+    while (!functions.empty()) {
+        auto current = functions.back();
+        functions.pop_back();
+        if (!visited.insert(current).second) {
+            continue;
+        }
+        const auto& body = current->GetBody();
+        for (const auto& [name, folded] : body->folded) {
+            callees.push_back({current->parent_scope_, name, folded});
+        }
+        std::vector<std::shared_ptr<Object>> forms(body->executables.begin(),
+                                                   body->executables.end());
+        while (!forms.empty()) {
+            auto form = std::move(forms.back());
+            forms.pop_back();
+            if (!Is<Cell>(form) || As<Cell>(form)->GetFirst() == kQuote) {
+                continue;
+            }
+            if (auto name = As<Symbol>(As<Cell>(form)->GetFirst())) {
+                auto callee = current->parent_scope_->FindFunction(name.get());
+                callees.push_back({current->parent_scope_, name.get(), callee});
+                if (auto user = dynamic_cast<UserFunction*>(callee.get())) {
+                    functions.push_back(user);
+                }
+            }
+            for (auto rest = form; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+                forms.push_back(As<Cell>(rest)->GetFirst());
+            }
+        }
+    }
+}
+
+bool UserFunction::Memo::HasSameCallees() const {
+    return std::all_of(callees.begin(), callees.end(), [](const Callee& callee) {
+        auto scope = callee.scope.lock();
+        return scope && scope->FindFunction(callee.name) == callee.function.lock();
+    });
+}
+
+void UserFunction::Trace(Heap* heap) {
+    IFunction::Trace(heap);
+    heap->MarkShared(body_);
+    heap->Mark(parent_scope_.get());
+    if (memo_) {
+        for (const auto& [key, result] : memo_->results) {
+            for (const auto& arg : key) {
+                heap->Mark(arg.get());
+            }
+            heap->Mark(result.get());
+        }
+    }
+}
+
+void UserFunction::Release() {
+    IFunction::Release();
+    body_.reset();
+    parent_scope_.reset();
+    if (memo_) {
+        memo_->results.clear();
+    }
+}
+
+// Folded calls hold only while their names resolve to the functions folded.
+const std::shared_ptr<const FunctionBody>& UserFunction::GetBody() {
+    if (body_->folded.empty()) {
+        return body_;
+    }
+    auto epoch = Scope::GetDefinitionEpoch();
+    if (body_epoch_ != epoch) {
+        const auto& folded = body_->folded;
+        if (!std::all_of(folded.begin(), folded.end(), [&](const auto& call) {
+                return parent_scope_->FindFunction(call.first) == call.second;
+            })) {
+            body_ = std::make_shared<FunctionBody>(body_->args, body_->source, parent_scope_);
+        }
+        body_epoch_ = epoch;
+    }
+    return body_;
+}
+
+bool UserFunction::IsPure() {
+    auto epoch = Scope::GetDefinitionEpoch();
+    if (purity_epoch_ != epoch) {
+        GetBody();
+        std::unordered_set<const UserFunction*> assumed;
+        is_pure_ = IsPureBody(&assumed);
+        purity_epoch_ = epoch;
+    }
+    return is_pure_;
+}
+
+// A body is pure if it reads nothing but its own arguments and calls only pure
+// functions. Functions already on the way are assumed pure, so recursion
+// doesn't make a function impure by itself.
+bool UserFunction::IsPureBody(std::unordered_set<const UserFunction*>* assumed) {
+    if (!assumed->insert(this).second) {
+        return true;
+    }
+    std::unordered_set<const Symbol*> args;
+    for (const auto& arg : body_->args) {
+        args.insert(arg.get());
+    }
+    const auto& executables = body_->executables;
+    std::vector<std::shared_ptr<Object>> stack(executables.rbegin(), executables.rend());
+    while (!stack.empty()) {
+        auto form = std::move(stack.back());
+        stack.pop_back();
+        if (!form || Is<Number>(form) || Is<String>(form) || Is<Vector>(form)) {
+            continue;
+        }
+        if (auto reference = As<Reference>(form)) {
+            form = reference->GetName();
+        }
+        if (Is<Symbol>(form)) {
+            if (IsBool(form) || args.contains(As<Symbol>(form).get())) {
+                continue;
+            }
+            return false;
+        }
+        if (!Is<Cell>(form) || !Is<Symbol>(As<Cell>(form)->GetFirst())) {
+            return false;
+        }
+        auto callee = parent_scope_->FindFunction(As<Symbol>(As<Cell>(form)->GetFirst()).get());
+        if (dynamic_cast<QuoteFunction*>(callee.get())) {
+            continue;
+        }
+        auto user = std::dynamic_pointer_cast<UserFunction>(callee);
+        if (!callee || (user ? !user->IsPureBody(assumed) : !callee->IsPure())) {
+            return false;
+        }
+        for (auto arg = As<Cell>(form)->GetSecond(); arg; arg = As<Cell>(arg)->GetSecond()) {
+            if (!Is<Cell>(arg)) {
+                return false;
+            }
+            stack.push_back(As<Cell>(arg)->GetFirst());
+        }
+    }
+    return true;
+}
+
+void UserFunction::EnableMemoization() {
+    if (!memo_) {
+        memo_ = std::make_shared<Memo>();
+    }
+}
+
+// Definitions the body doesn't call keep the results.
+UserFunction::Memo* UserFunction::GetMemo() {
+    auto epoch = Scope::GetDefinitionEpoch();
+    if (memo_->epoch != epoch) {
+        if (memo_->results.empty() || !memo_->HasSameCallees()) {
+            memo_->results.clear();
+            memo_->RecordCallees(this);
+        }
+        memo_->epoch = epoch;
+    }
+    return memo_.get();
+}
+
+std::shared_ptr<Object> UserFunction::FindMemoized(std::span<const std::shared_ptr<Object>> args) {
+    if (!std::all_of(args.begin(), args.end(), IsAtom) || !IsPure()) {
+        return nullptr;
+    }
+    auto memo = GetMemo();
+    if (auto it = memo->results.find(args); it != memo->results.end()) {
+        ++memo->hits;
+        return it->second;
+    }
+    ++memo->misses;
+    return nullptr;
+}
+
+// Lists and vectors returned could be changed by the caller, so only atoms are
+// kept.
+void UserFunction::StoreMemoized(std::span<const std::shared_ptr<Object>> args,
+                                 std::shared_ptr<Object> result) {
+    if (!std::all_of(args.begin(), args.end(), IsAtom) || !IsAtom(result) || !IsPure()) {
+        return;
+    }
+    auto memo = GetMemo();
+    if (memo->results.size() >= Memo::kMaxResults) {
+        memo->results.clear();
+    }
+    memo->results.emplace(std::vector(args.begin(), args.end()), Alias(std::move(result)));
+}
+
+MemoStats UserFunction::GetMemoStats() {
+    if (!memo_) {
+        return {};
+    }
+    auto memo = GetMemo();
+    return {IsPure(), memo->hits, memo->misses, memo->results.size()};
+}
+
+std::shared_ptr<Scope> UserFunction::CreateFrame() {
+    Metrics::CountFrame();
+    auto frame = GetHeap().Make<Scope>();
+    frame->AddParentScope(parent_scope_);
+    frame->SetLayout(body_->layout);
+    return frame;
+}
+
+const Symbol* UserFunction::GetName() const {
+    static const auto kLambda = Symbol::Intern("lambda");
+    return name_ ? name_ : kLambda.get();
+}
+
+const std::shared_ptr<const Chunk>& UserFunction::GetChunk() {
+    const auto& body = *GetBody();
+    if (!body.chunk) {
+        body.chunk = Compile(body.executables, body.layout, parent_scope_);
+    }
+    return body.chunk;
+}
+
+std::shared_ptr<Object> IFunction::Apply(std::span<const std::shared_ptr<Object>>) {
+    throw RuntimeError("Function can't be applied to evaluated arguments");
+}
+
+std::shared_ptr<FunctionObject> IFunction::GetFunctionObject() {
+    auto object = function_object_.lock();
+    if (!object) {
+        object = GetHeap().Make<FunctionObject>(shared_from_this());
+        function_object_ = object;
+    }
+    return object;
+}
+
+ArithmeticFunction::Accumulator::Accumulator(const Number& first) {
+    if (first.IsFixnum()) {
+        fixnum = first.GetValue();
+    } else {
+        big = first.ToBigInteger();
+    }
+}
+
+// Stays on fixnums until an operation overflows, then finishes in bignums.
+void ArithmeticFunction::Accumulate(Accumulator* ans, const Number& rhs) {
+    if (!ans->big) {
+        int64_t result;
+        if (rhs.IsFixnum() && Operation(ans->fixnum, rhs.GetValue(), &result)) {
+            ans->fixnum = result;
+            return;
+        }
+        ans->big = BigInteger(ans->fixnum);
+    }
+    ans->big = Operation(*ans->big, rhs.ToBigInteger());
+}
+
 std::shared_ptr<Object> ArithmeticFunction::Execute(std::shared_ptr<Object> object,
                                                     std::shared_ptr<Scope> scope) {
-    int64_t ans = 0;
+    Accumulator ans;
     bool is_first = true;
     std::shared_ptr<Object> lhs;
     while (Is<Cell>(object)) {
@@ -185,9 +1010,9 @@ std::shared_ptr<Object> ArithmeticFunction::Execute(std::shared_ptr<Object> obje
             throw RuntimeError("Bad list");
         }
         if (is_first) {
-            ans = As<Number>(lhs)->GetValue();
+            ans = Accumulator(*As<Number>(lhs));
         } else {
-            ans = Operation(ans, As<Number>(lhs)->GetValue());
+            Accumulate(&ans, *As<Number>(lhs));
         }
         is_first = false;
         object = As<Cell>(object)->GetSecond();
@@ -195,10 +1020,43 @@ std::shared_ptr<Object> ArithmeticFunction::Execute(std::shared_ptr<Object> obje
     if (object) {
         throw RuntimeError("Bad list");
     }
-    if (is_first) {
-        return std::make_shared<Number>(GetDefaultValue());
-    }
-    return std::make_shared<Number>(ans);
+    if (is_first) {
+        return Number::Make(GetDefaultValue());
+    }
+    return ans.big ? Number::Make(std::move(*ans.big)) : Number::Make(ans.fixnum);
+}
+
+std::shared_ptr<Object> ArithmeticFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    if (args.empty()) {
+        return Number::Make(GetDefaultValue());
+    }
+    Accumulator ans;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (!Is<Number>(args[i])) {
+            throw RuntimeError("Bad list");
+        }
+        const auto& number = static_cast<const Number&>(*args[i]);
+        if (i == 0) {
+            ans = Accumulator(number);
+        } else {
+            Accumulate(&ans, number);
+        }
+    }
+    return ans.big ? Number::Make(std::move(*ans.big)) : Number::Make(ans.fixnum);
+}
+
+std::shared_ptr<Object> StrictFunction::Execute(std::shared_ptr<Object> object,
+                                                std::shared_ptr<Scope> scope) {
+    EvaluatedArguments args;
+    Heap::RootGuard args_guard(&args);
+    while (Is<Cell>(object)) {
+        args.values.push_back(Evaluate(As<Cell>(object)->GetFirst(), scope));
+        object = As<Cell>(object)->GetSecond();
+    }
+    if (object) {
+        throw RuntimeError("Bad list");
+    }
+    return Apply(args.values);
 }
 
 std::shared_ptr<Object> BooleanFunction::Execute(std::shared_ptr<Object> object,
@@ -218,21 +1076,27 @@ std::shared_ptr<Object> BooleanFunction::Execute(std::shared_ptr<Object> object,
     return prev;
 }
 
+// Bignums are compared through the sign of their three-way comparison.
+bool ComparisonFunction::CompareNumbers(const Number& lhs, const Number& rhs) {
+    if (lhs.IsFixnum() && rhs.IsFixnum()) {
+        return Compare(lhs.GetValue(), rhs.GetValue());
+    }
+    return Compare(lhs.ToBigInteger().Compare(rhs.ToBigInteger()), 0);
+}
+
 std::shared_ptr<Object> ComparisonFunction::Execute(std::shared_ptr<Object> object,
                                                     std::shared_ptr<Scope> scope) {
-    bool ans = true, is_first = true;
-    int64_t prev;
-    std::shared_ptr<Object> lhs;
+    bool ans = true;
+    std::shared_ptr<Object> lhs, prev;
     while (Is<Cell>(object)) {
         lhs = Evaluate(As<Cell>(object)->GetFirst(), scope);
         if (!Is<Number>(lhs)) {
             throw RuntimeError("Bad list");
         }
-        if (!is_first) {
-            ans = (ans && Compare(prev, As<Number>(lhs)->GetValue()));
+        if (prev) {
+            ans = (ans && CompareNumbers(*As<Number>(prev), *As<Number>(lhs)));
         }
-        prev = As<Number>(lhs)->GetValue();
-        is_first = false;
+        prev = lhs;
         object = As<Cell>(object)->GetSecond();
     }
     if (object) {
@@ -241,6 +1105,20 @@ std::shared_ptr<Object> ComparisonFunction::Execute(std::shared_ptr<Object> obje
     return BoolToSymbol(ans);
 }
 
+std::shared_ptr<Object> ComparisonFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    bool ans = true;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (!Is<Number>(args[i])) {
+            throw RuntimeError("Bad list");
+        }
+        if (i > 0) {
+            ans = (ans && CompareNumbers(static_cast<const Number&>(*args[i - 1]),
+                                         static_cast<const Number&>(*args[i])));
+        }
+    }
+    return BoolToSymbol(ans);
+}
+
 std::shared_ptr<Object> OneArgumentFunction::Execute(std::shared_ptr<Object> object,
                                                      std::shared_ptr<Scope> scope) {
     if (!Is<Cell>(object) || As<Cell>(object)->GetSecond()) {
@@ -255,7 +1133,11 @@ std::shared_ptr<Object> AbsFunction::Function(std::shared_ptr<Object> object,
     if (!Is<Number>(object)) {
         throw RuntimeError("Invalid argument");
     }
-    return std::make_shared<Number>(std::abs(As<Number>(object)->GetValue()));
+    auto number = As<Number>(object);
+    if (number->IsFixnum() && number->GetValue() != std::numeric_limits<int64_t>::min()) {
+        return Number::Make(std::abs(number->GetValue()));
+    }
+    return Number::Make(number->ToBigInteger().Abs());
 }
 
 std::shared_ptr<Object> IsNumberFunction::Function(std::shared_ptr<Object> object,
@@ -294,6 +1176,21 @@ std::shared_ptr<Object> IsSymbolFunction::Function(std::shared_ptr<Object> objec
     return BoolToSymbol(Is<Symbol>(object) && !IsBool(object));
 }
 
+std::shared_ptr<Object> IsHashTableFunction::Function(std::shared_ptr<Object> object,
+                                                      std::shared_ptr<Scope> scope) {
+    return BoolToSymbol(Is<HashTable>(Evaluate(object, scope)));
+}
+
+std::shared_ptr<Object> IsStringFunction::Function(std::shared_ptr<Object> object,
+                                                   std::shared_ptr<Scope> scope) {
+    return BoolToSymbol(Is<String>(Evaluate(object, scope)));
+}
+
+std::shared_ptr<Object> IsVectorFunction::Function(std::shared_ptr<Object> object,
+                                                   std::shared_ptr<Scope> scope) {
+    return BoolToSymbol(Is<Vector>(Evaluate(object, scope)));
+}
+
 std::shared_ptr<Object> QuoteFunction::Function(std::shared_ptr<Object> object,
                                                 std::shared_ptr<Scope>) {
     return object;
@@ -311,7 +1208,7 @@ std::shared_ptr<Object> GetFirstElementFunction::Function(std::shared_ptr<Object
         throw RuntimeError("Invalid argument");
     }
     auto ans = As<Cell>(object)->GetFirst();
-    if (ans && object->object_scope) {
+    if (object->object_scope && Is<Cell>(ans)) {
         ans->object_scope = object->object_scope;
     }
     return ans;
@@ -324,7 +1221,7 @@ std::shared_ptr<Object> GetSecondElementFunction::Function(std::shared_ptr<Objec
         throw RuntimeError("Invalid argument");
     }
     auto ans = As<Cell>(object)->GetSecond();
-    if (ans && object->object_scope) {
+    if (object->object_scope && Is<Cell>(ans)) {
         ans->object_scope = object->object_scope;
     }
     return ans;
@@ -338,7 +1235,11 @@ std::shared_ptr<Object> GetElementFunction::Execute(std::shared_ptr<Object> obje
         throw RuntimeError("Invalid argument");
     }
     std::shared_ptr<Object> list = Evaluate(As<Cell>(object)->GetFirst(), scope);
-    size_t index = As<Number>(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst())->GetValue();
+    auto number = As<Number>(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst());
+    if (!number->IsFixnum()) {
+        throw RuntimeError("Out of bounds");
+    }
+    size_t index = number->GetValue();
     while (Is<Cell>(list) && index > 0) {
         list = As<Cell>(list)->GetSecond();
         --index;
@@ -357,7 +1258,11 @@ std::shared_ptr<Object> GetTailFunction::Execute(std::shared_ptr<Object> object,
         throw RuntimeError("Invalid argument");
     }
     std::shared_ptr<Object> list = Evaluate(As<Cell>(object)->GetFirst(), scope);
-    size_t index = As<Number>(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst())->GetValue();
+    auto number = As<Number>(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst());
+    if (!number->IsFixnum()) {
+        throw RuntimeError("Out of bounds");
+    }
+    size_t index = number->GetValue();
     while (Is<Cell>(list) && index > 0) {
         list = As<Cell>(list)->GetSecond();
         --index;
@@ -374,8 +1279,8 @@ std::shared_ptr<Object> ConstructPairFunction::Execute(std::shared_ptr<Object> o
         As<Cell>(As<Cell>(object)->GetSecond())->GetSecond()) {
         throw RuntimeError("Invalid argument");
     }
-    return std::make_shared<Cell>(As<Cell>(object)->GetFirst(),
-                                  As<Cell>(As<Cell>(object)->GetSecond())->GetFirst());
+    return GetHeap().Make<Cell>(As<Cell>(object)->GetFirst(),
+                                As<Cell>(As<Cell>(object)->GetSecond())->GetFirst());
 }
 
 std::shared_ptr<Object> ConstructListFunction::Execute(std::shared_ptr<Object> object,
@@ -385,20 +1290,54 @@ std::shared_ptr<Object> ConstructListFunction::Execute(std::shared_ptr<Object> o
 
 std::shared_ptr<Object> IfFunction::Execute(std::shared_ptr<Object> object,
                                             std::shared_ptr<Scope> scope) {
+    return ExecuteTail(object, scope, nullptr);
+}
+
+std::shared_ptr<Object> IfFunction::ExecuteTail(std::shared_ptr<Object> object,
+                                                std::shared_ptr<Scope> scope,
+                                                TailCall* tail_call) {
     if (!Is<Cell>(object) || !Is<Cell>(As<Cell>(object)->GetSecond()) ||
         (As<Cell>(As<Cell>(object)->GetSecond())->GetSecond() &&
          (!Is<Cell>(As<Cell>(As<Cell>(object)->GetSecond())->GetSecond()) ||
           As<Cell>(As<Cell>(As<Cell>(object)->GetSecond())->GetSecond())->GetSecond()))) {
         throw SyntaxError("Invalid argument");
     }
+    std::shared_ptr<Object> branch;
     if (ObjectToBool(Evaluate(As<Cell>(object)->GetFirst(), scope))) {
-        return Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope);
+        branch = As<Cell>(As<Cell>(object)->GetSecond())->GetFirst();
+    } else if (As<Cell>(As<Cell>(object)->GetSecond())->GetSecond()) {
+        branch = As<Cell>(As<Cell>(As<Cell>(object)->GetSecond())->GetSecond())->GetFirst();
+    } else {
+        return nullptr;
+    }
+    if (tail_call) {
+        return EvaluateTail(branch, scope, tail_call);
     }
-    if (!As<Cell>(As<Cell>(object)->GetSecond())->GetSecond()) {
+    return Evaluate(branch, scope);
+}
+
+std::shared_ptr<Object> BeginFunction::Execute(std::shared_ptr<Object> object,
+                                               std::shared_ptr<Scope> scope) {
+    return ExecuteTail(object, scope, nullptr);
+}
+
+std::shared_ptr<Object> BeginFunction::ExecuteTail(std::shared_ptr<Object> object,
+                                                   std::shared_ptr<Scope> scope,
+                                                   TailCall* tail_call) {
+    if (!object) {
         return nullptr;
     }
-    return Evaluate(As<Cell>(As<Cell>(As<Cell>(object)->GetSecond())->GetSecond())->GetFirst(),
-                    scope);
+    while (Is<Cell>(object) && As<Cell>(object)->GetSecond()) {
+        Evaluate(As<Cell>(object)->GetFirst(), scope);
+        object = As<Cell>(object)->GetSecond();
+    }
+    if (!Is<Cell>(object)) {
+        throw SyntaxError("Invalid argument");
+    }
+    if (tail_call) {
+        return EvaluateTail(As<Cell>(object)->GetFirst(), scope, tail_call);
+    }
+    return Evaluate(As<Cell>(object)->GetFirst(), scope);
 }
 
 std::shared_ptr<Object> DefineFunction::Execute(std::shared_ptr<Object> object,
@@ -411,29 +1350,29 @@ std::shared_ptr<Object> DefineFunction::Execute(std::shared_ptr<Object> object,
         if (!Is<Cell>(list) || !Is<Symbol>(As<Cell>(list)->GetFirst())) {
             throw SyntaxError("Invalid argument");
         }
-        std::string name = As<Symbol>(As<Cell>(list)->GetFirst())->GetName();
-        std::vector<std::string> args;
+        auto name = As<Symbol>(As<Cell>(list)->GetFirst());
+        std::vector<std::shared_ptr<Symbol>> args;
         list = As<Cell>(list)->GetSecond();
         while (list) {
             if (!Is<Cell>(list) || !Is<Symbol>(As<Cell>(list)->GetFirst())) {
                 throw SyntaxError("Invalid argument");
             }
-            args.push_back(As<Symbol>(As<Cell>(list)->GetFirst())->GetName());
+            args.push_back(As<Symbol>(As<Cell>(list)->GetFirst()));
             list = As<Cell>(list)->GetSecond();
         }
-        object = As<Cell>(object)->GetSecond();
         std::vector<std::shared_ptr<Object>> executables;
-        while (object) {
-            if (!Is<Cell>(object)) {
+        for (auto body = As<Cell>(object)->GetSecond(); body; body = As<Cell>(body)->GetSecond()) {
+            if (!Is<Cell>(body)) {
                 throw SyntaxError("Invalid argument");
             }
-            executables.push_back(As<Cell>(object)->GetFirst());
-            object = As<Cell>(object)->GetSecond();
+            executables.push_back(As<Cell>(body)->GetFirst());
         }
         if (executables.empty()) {
             throw SyntaxError("Lambda should have at least 1 expression");
         }
-        return scope->AddFunction(name, std::make_shared<UserFunction>(args, executables, scope));
+        return scope->AddFunction(
+            name, GetHeap().Make<UserFunction>(
+                      As<Cell>(object)->PrepareBody(args, executables, scope), scope));
     }
     if (!Is<Cell>(As<Cell>(object)->GetSecond()) ||
         As<Cell>(As<Cell>(object)->GetSecond())->GetSecond()) {
@@ -442,25 +1381,82 @@ std::shared_ptr<Object> DefineFunction::Execute(std::shared_ptr<Object> object,
     std::shared_ptr<Object> second =
         Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope);
     if (Is<FunctionObject>(second)) {
-        return scope->AddFunction(As<Symbol>(As<Cell>(object)->GetFirst())->GetName(),
+        return scope->AddFunction(As<Symbol>(As<Cell>(object)->GetFirst()),
                                   As<FunctionObject>(second)->GetFunction());
     }
-    return scope->AddVariable(As<Symbol>(As<Cell>(object)->GetFirst())->GetName(),
+    return scope->AddVariable(As<Symbol>(As<Cell>(object)->GetFirst()),
                               Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope));
 }
 
+// The target is a Reference in a resolved function body.
 std::shared_ptr<Object> SetFunction::Execute(std::shared_ptr<Object> object,
                                              std::shared_ptr<Scope> scope) {
     if (!Is<Cell>(object) || !Is<Cell>(As<Cell>(object)->GetSecond()) ||
-        As<Cell>(As<Cell>(object)->GetSecond())->GetSecond() ||
-        !Is<Symbol>(As<Cell>(object)->GetFirst())) {
+        As<Cell>(As<Cell>(object)->GetSecond())->GetSecond()) {
+        throw SyntaxError("Invalid argument");
+    }
+    auto target = As<Cell>(object)->GetFirst();
+    if (auto reference = As<Reference>(target)) {
+        return scope->UpdateVariable(
+            reference->GetName().get(), reference->GetAddress(),
+            Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope));
+    }
+    if (!Is<Symbol>(target)) {
         throw SyntaxError("Invalid argument");
     }
     return scope->UpdateVariable(
-        As<Symbol>(As<Cell>(object)->GetFirst())->GetName(),
+        As<Symbol>(target).get(),
         Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope));
 }
 
+std::shared_ptr<Object> DefineMemoizedFunction::Execute(std::shared_ptr<Object> object,
+                                                        std::shared_ptr<Scope> scope) {
+    if (!Is<Cell>(object) || !Is<Cell>(As<Cell>(object)->GetFirst())) {
+        throw SyntaxError("Invalid argument");
+    }
+    auto name = DefineFunction::Execute(object, scope);
+    std::static_pointer_cast<UserFunction>(scope->GetFunction(As<Symbol>(name).get()))
+        ->EnableMemoization();
+    return name;
+}
+
+std::shared_ptr<Object> DefineSyntaxFunction::Execute(std::shared_ptr<Object> object,
+                                                      std::shared_ptr<Scope> scope) {
+    if (!Is<Cell>(object) || !Is<Symbol>(As<Cell>(object)->GetFirst()) ||
+        !Is<Cell>(As<Cell>(object)->GetSecond()) ||
+        As<Cell>(As<Cell>(object)->GetSecond())->GetSecond()) {
+        throw SyntaxError("Invalid argument");
+    }
+    auto name = As<Symbol>(As<Cell>(object)->GetFirst());
+    return scope->AddFunction(
+        name,
+        GetHeap().Make<Macro>(name, As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope));
+}
+
+std::shared_ptr<Object> MemoStatsFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    auto function = Is<FunctionObject>(args[0])
+                        ? std::dynamic_pointer_cast<UserFunction>(
+                              As<FunctionObject>(args[0])->GetFunction())
+                        : nullptr;
+    if (!function || !function->IsMemoized()) {
+        throw RuntimeError("Invalid argument");
+    }
+    auto stats = function->GetMemoStats();
+    std::pair<std::string, std::shared_ptr<Object>> fields[] = {
+        {"pure", BoolToSymbol(stats.is_pure)},
+        {"hits", Number::Make(static_cast<int64_t>(stats.hits))},
+        {"misses", Number::Make(static_cast<int64_t>(stats.misses))},
+        {"size", Number::Make(static_cast<int64_t>(stats.size))},
+    };
+    std::shared_ptr<Object> ans;
+    for (auto it = std::rbegin(fields); it != std::rend(fields); ++it) {
+        auto field = GetHeap().Make<Cell>(Symbol::Intern(it->first), it->second);
+        ans = GetHeap().Make<Cell>(field, ans);
+    }
+    return ans;
+}
+
 std::shared_ptr<Object> SetFirstFunction::Execute(std::shared_ptr<Object> object,
                                                   std::shared_ptr<Scope> scope) {
     if (!Is<Cell>(object) || !Is<Cell>(As<Cell>(object)->GetSecond()) ||
@@ -472,7 +1468,7 @@ std::shared_ptr<Object> SetFirstFunction::Execute(std::shared_ptr<Object> object
         throw SyntaxError("Invalid argument");
     }
     As<Cell>(pair)->GetFirst() =
-        Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope);
+        Alias(Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope));
     return pair;
 }
 
@@ -487,7 +1483,7 @@ std::shared_ptr<Object> SetSecondFunction::Execute(std::shared_ptr<Object> objec
         throw SyntaxError("Invalid argument");
     }
     As<Cell>(pair)->GetSecond() =
-        Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope);
+        Alias(Evaluate(As<Cell>(As<Cell>(object)->GetSecond())->GetFirst(), scope));
     return pair;
 }
 
@@ -497,38 +1493,652 @@ std::shared_ptr<Object> LambdaFunction::Execute(std::shared_ptr<Object> object,
         throw SyntaxError("Invalid argument");
     }
     std::shared_ptr<Object> list = As<Cell>(object)->GetFirst();
-    std::vector<std::string> args;
+    std::vector<std::shared_ptr<Symbol>> args;
     while (list) {
         if (!Is<Cell>(list) || !Is<Symbol>(As<Cell>(list)->GetFirst())) {
             throw SyntaxError("Invalid argument");
         }
-        args.push_back(As<Symbol>(As<Cell>(list)->GetFirst())->GetName());
+        args.push_back(As<Symbol>(As<Cell>(list)->GetFirst()));
         list = As<Cell>(list)->GetSecond();
     }
-    object = As<Cell>(object)->GetSecond();
     std::vector<std::shared_ptr<Object>> executables;
-    while (object) {
-        if (!Is<Cell>(object)) {
+    for (auto body = As<Cell>(object)->GetSecond(); body; body = As<Cell>(body)->GetSecond()) {
+        if (!Is<Cell>(body)) {
             throw SyntaxError("Invalid argument");
         }
-        executables.push_back(As<Cell>(object)->GetFirst());
-        object = As<Cell>(object)->GetSecond();
+        executables.push_back(As<Cell>(body)->GetFirst());
     }
     if (executables.empty()) {
         throw SyntaxError("Lambda should have at least 1 expression");
     }
-    return std::make_shared<FunctionObject>(
-        std::make_shared<UserFunction>(args, executables, scope));
+    return GetHeap().Make<FunctionObject>(
+        GetHeap().Make<UserFunction>(As<Cell>(object)->PrepareBody(args, executables, scope),
+                                     scope));
+}
+
+std::shared_ptr<Object> GcFunction::Execute(std::shared_ptr<Object> object,
+                                            std::shared_ptr<Scope>) {
+    if (object) {
+        throw RuntimeError("Invalid argument");
+    }
+    return Number::Make(GetHeap().Collect().reclaimed_bytes);
+}
+
+std::shared_ptr<Object> GcStatsFunction::Execute(std::shared_ptr<Object> object,
+                                                 std::shared_ptr<Scope>) {
+    if (object) {
+        throw RuntimeError("Invalid argument");
+    }
+    const auto& stats = GetHeap().GetStats();
+    std::pair<std::string, size_t> fields[] = {
+        {"collections", stats.collections},
+        {"live-objects", stats.live_objects},
+        {"live-bytes", stats.live_bytes},
+        {"reclaimed-objects", stats.reclaimed_objects},
+        {"reclaimed-bytes", stats.reclaimed_bytes},
+        {"total-reclaimed-bytes", stats.total_reclaimed_bytes},
+    };
+    std::shared_ptr<Object> ans;
+    for (auto it = std::rbegin(fields); it != std::rend(fields); ++it) {
+        auto field = GetHeap().Make<Cell>(Symbol::Intern(it->first),
+                                          Number::Make(it->second));
+        ans = GetHeap().Make<Cell>(field, ans);
+    }
+    return ans;
+}
+
+// Builtins that were never called are left out of the calls list.
+std::shared_ptr<Object> RuntimeStatsFunction::Execute(std::shared_ptr<Object> object,
+                                                      std::shared_ptr<Scope>) {
+    if (object) {
+        throw RuntimeError("Invalid argument");
+    }
+    auto stats = Metrics::GetStats();
+    std::shared_ptr<Object> calls;
+    for (auto it = stats.builtin_calls.rbegin(); it != stats.builtin_calls.rend(); ++it) {
+        if (it->second) {
+            auto call = GetHeap().Make<Cell>(Symbol::Intern(it->first), Number::Make(it->second));
+            calls = GetHeap().Make<Cell>(call, calls);
+        }
+    }
+    std::shared_ptr<Object> ans = GetHeap().Make<Cell>(
+        GetHeap().Make<Cell>(Symbol::Intern("calls"), calls), nullptr);
+    std::pair<std::string, uint64_t> fields[] = {
+        {"enabled", Metrics::IsEnabled()},
+        {"evaluations", stats.evaluations},
+        {"frames", stats.frames},
+        {"runs", stats.runs},
+        {"run-nanoseconds", stats.run_nanoseconds},
+    };
+    for (auto it = std::rbegin(fields); it != std::rend(fields); ++it) {
+        auto field = GetHeap().Make<Cell>(Symbol::Intern(it->first),
+                                          Number::Make(it->second));
+        ans = GetHeap().Make<Cell>(field, ans);
+    }
+    return ans;
+}
+
+std::shared_ptr<Object> MakeVectorFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 2);
+    auto size = As<Number>(args[0]);
+    if (!size || !size->IsFixnum() || size->GetValue() < 0) {
+        throw RuntimeError("Invalid argument");
+    }
+    auto fill = args.size() == 2 ? Alias(args[1]) : Number::Make(0);
+    // A length no allocation can satisfy is an error of the program.
+    try {
+        return GetHeap().Make<Vector>(
+            std::vector<std::shared_ptr<Object>>(size->GetValue(), fill));
+    } catch (const std::bad_alloc&) {
+        throw RuntimeError("Vector is too long");
+    } catch (const std::length_error&) {
+        throw RuntimeError("Vector is too long");
+    }
+}
+
+std::shared_ptr<Object> ConstructVectorFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    for (const auto& arg : args) {
+        Alias(arg);
+    }
+    return GetHeap().Make<Vector>(std::vector<std::shared_ptr<Object>>(args.begin(), args.end()));
+}
+
+std::shared_ptr<Object> VectorRefFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 2);
+    auto& elements = ToVector(args[0]).GetElements();
+    return elements[ToIndex(args[1], elements.size())];
+}
+
+// Returns the vector, as set-car! returns the pair.
+std::shared_ptr<Object> VectorSetFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 3, 3);
+    auto& elements = ToVector(args[0]).GetElements();
+    elements[ToIndex(args[1], elements.size())] = Alias(args[2]);
+    return args[0];
+}
+
+std::shared_ptr<Object> VectorLengthFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    return Number::Make(static_cast<int64_t>(ToVector(args[0]).GetElements().size()));
+}
+
+std::shared_ptr<Object> VectorToListFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    const auto& elements = ToVector(args[0]).GetElements();
+    std::shared_ptr<Object> ans;
+    for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+        ans = GetHeap().Make<Cell>(Alias(*it), ans);
+    }
+    return ans;
+}
+
+std::shared_ptr<Object> ListToVectorFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    std::vector<std::shared_ptr<Object>> elements;
+    auto list = args[0];
+    while (Is<Cell>(list)) {
+        elements.push_back(Alias(As<Cell>(list)->GetFirst()));
+        list = As<Cell>(list)->GetSecond();
+    }
+    if (list) {
+        throw RuntimeError("Invalid argument");
+    }
+    return GetHeap().Make<Vector>(std::move(elements));
+}
+
+std::shared_ptr<Object> IsEqFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 2);
+    return BoolToSymbol(IsEqv(args[0], args[1]));
+}
+
+std::shared_ptr<Object> IsEqualFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 2);
+    return BoolToSymbol(IsEqual(args[0], args[1]));
+}
+
+// The optional argument is the name of the key comparison, 'eq? or 'equal?
+// (the default), since builtins can't be passed as values.
+std::shared_ptr<Object> MakeHashTableFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    static const auto kEq = Symbol::Intern("eq?"), kEqual = Symbol::Intern("equal?");
+    CheckArgumentCount(args, 0, 1);
+    if (args.empty() || args[0] == kEqual) {
+        return GetHeap().Make<HashTable>(HashTable::Equality::EQUAL);
+    }
+    if (args[0] == kEq) {
+        return GetHeap().Make<HashTable>(HashTable::Equality::EQV);
+    }
+    throw RuntimeError("Invalid argument");
+}
+
+// Takes an optional default for missing keys.
+std::shared_ptr<Object> HashTableRefFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 3);
+    if (auto value = ToHashTable(args[0]).Find(args[1])) {
+        return *value;
+    }
+    if (args.size() == 3) {
+        return args[2];
+    }
+    throw RuntimeError("Key not found");
+}
+
+std::shared_ptr<Object> HashTableSetFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 3, 3);
+    ToHashTable(args[0]).Set(Alias(args[1]), Alias(args[2]));
+    return args[0];
+}
+
+std::shared_ptr<Object> HashTableDeleteFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 2);
+    ToHashTable(args[0]).Erase(args[1]);
+    return args[0];
+}
+
+std::shared_ptr<Object> HashTableContainsFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 2);
+    return BoolToSymbol(ToHashTable(args[0]).Find(args[1]));
+}
+
+std::shared_ptr<Object> HashTableCountFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    return Number::Make(static_cast<int64_t>(ToHashTable(args[0]).GetSize()));
+}
+
+std::shared_ptr<Object> HashTableKeysFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    std::shared_ptr<Object> ans;
+    ToHashTable(args[0]).ForEach([&](const auto& key, const auto&) {
+        ans = GetHeap().Make<Cell>(Alias(key), ans);
+    });
+    return ans;
+}
+
+std::shared_ptr<Object> HashTableValuesFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    std::shared_ptr<Object> ans;
+    ToHashTable(args[0]).ForEach([&](const auto&, const auto& value) {
+        ans = GetHeap().Make<Cell>(Alias(value), ans);
+    });
+    return ans;
+}
+
+std::shared_ptr<Object> HashTableToAlistFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    std::shared_ptr<Object> ans;
+    ToHashTable(args[0]).ForEach([&](const auto& key, const auto& value) {
+        auto entry = GetHeap().Make<Cell>(Alias(key), Alias(value));
+        ans = GetHeap().Make<Cell>(entry, ans);
+    });
+    return ans;
+}
+
+std::shared_ptr<Object> StringLengthFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    return Number::Make(static_cast<int64_t>(ToString(args[0]).size()));
+}
+
+// Sizes the result up front, so appending n strings copies each byte once.
+std::shared_ptr<Object> StringAppendFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    size_t size = 0;
+    for (const auto& arg : args) {
+        size += ToString(arg).size();
+    }
+    std::string ans;
+    ans.reserve(size);
+    for (const auto& arg : args) {
+        ans += ToString(arg);
+    }
+    return GetHeap().Make<String>(std::move(ans));
+}
+
+// Indexes count bytes; the end defaults to the end of the string.
+std::shared_ptr<Object> SubstringFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 3);
+    const auto& string = ToString(args[0]);
+    auto start = ToIndex(args[1], string.size() + 1);
+    auto end = args.size() == 3 ? ToIndex(args[2], string.size() + 1) : string.size();
+    if (start > end) {
+        throw RuntimeError("Out of bounds");
+    }
+    return GetHeap().Make<String>(string.substr(start, end - start));
+}
+
+std::shared_ptr<Object> IsStringEqualFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    bool ans = true;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const auto& string = ToString(args[i]);
+        if (i > 0 && string != ToString(args[i - 1])) {
+            ans = false;
+        }
+    }
+    return BoolToSymbol(ans);
+}
+
+std::shared_ptr<Object> StringToSymbolFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    return Symbol::Intern(ToString(args[0]));
+}
+
+std::shared_ptr<Object> SymbolToStringFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    if (!Is<Symbol>(args[0])) {
+        throw RuntimeError("Invalid argument");
+    }
+    return GetHeap().Make<String>(As<Symbol>(args[0])->GetName());
+}
+
+std::shared_ptr<Object> NumberToStringFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    if (!Is<Number>(args[0])) {
+        throw RuntimeError("Invalid argument");
+    }
+    return GetHeap().Make<String>(As<Number>(args[0])->ToString());
+}
+
+std::shared_ptr<Object> OpenOutputStringFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 0, 0);
+    return GetHeap().Make<StringPort>();
+}
+
+// Returns the port, so that writes can be chained.
+std::shared_ptr<Object> WriteStringFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 2);
+    ToStringPort(args[1]).GetBuffer() += ToString(args[0]);
+    return args[1];
+}
+
+// Strings are written as they are, anything else as the interpreter prints it.
+std::shared_ptr<Object> DisplayFunction::Apply(std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 2, 2);
+    auto& buffer = ToStringPort(args[1]).GetBuffer();
+    if (Is<String>(args[0])) {
+        buffer += As<String>(args[0])->GetValue();
+    } else {
+        std::ostringstream out;
+        Serialize(args[0], &out);
+        buffer += out.view();
+    }
+    return args[1];
+}
+
+std::shared_ptr<Object> GetOutputStringFunction::Apply(
+    std::span<const std::shared_ptr<Object>> args) {
+    CheckArgumentCount(args, 1, 1);
+    return GetHeap().Make<String>(ToStringPort(args[0]).GetBuffer());
+}
+
+void Vector::Trace(Heap* heap) {
+    Object::Trace(heap);
+    for (const auto& element : elements_) {
+        heap->Mark(element.get());
+    }
+}
+
+void Vector::Release() {
+    Object::Release();
+    elements_.clear();
+}
+
+bool EvaluatesArguments(IFunction* function) {
+    if (dynamic_cast<QuoteFunction*>(function)) {
+        return false;
+    }
+    return dynamic_cast<ArithmeticFunction*>(function) ||
+           dynamic_cast<ComparisonFunction*>(function) ||
+           dynamic_cast<BooleanFunction*>(function) ||
+           dynamic_cast<OneArgumentFunction*>(function) ||
+           dynamic_cast<BeginFunction*>(function) ||
+           dynamic_cast<StrictFunction*>(function) || dynamic_cast<UserFunction*>(function);
+}
+
+bool IsEqv(const std::shared_ptr<Object>& lhs, const std::shared_ptr<Object>& rhs) {
+    if (lhs == rhs) {
+        return true;
+    }
+    if (!Is<Number>(lhs) || !Is<Number>(rhs)) {
+        return false;
+    }
+    const auto& lhs_number = static_cast<const Number&>(*lhs);
+    const auto& rhs_number = static_cast<const Number&>(*rhs);
+    if (lhs_number.IsFixnum() || rhs_number.IsFixnum()) {
+        return lhs_number.IsFixnum() && rhs_number.IsFixnum() &&
+               lhs_number.GetValue() == rhs_number.GetValue();
+    }
+    return lhs_number.ToBigInteger().Compare(rhs_number.ToBigInteger()) == 0;
+}
+
+// Identical parts aren't descended into, which also lets a cyclic structure
+// be compared with itself.
+// A pair of cells or vectors met again is taken to be equal: if they differ,
+// that shows up on the first visit. So comparing cyclic structures ends.
+bool IsEqual(const std::shared_ptr<Object>& lhs, const std::shared_ptr<Object>& rhs) {
+    std::vector<std::pair<Object*, Object*>> stack{{lhs.get(), rhs.get()}};
+    std::set<std::pair<Object*, Object*>> visited;
+    while (!stack.empty()) {
+        auto [left, right] = stack.back();
+        stack.pop_back();
+        if (left == right) {
+            continue;
+        }
+        if (!left || !right || left->GetType() != right->GetType()) {
+            return false;
+        }
+        auto type = left->GetType();
+        if ((type == ObjectType::CELL || type == ObjectType::VECTOR) &&
+            !visited.emplace(left, right).second) {
+            continue;
+        }
+        if (type == ObjectType::CELL) {
+            auto left_cell = static_cast<Cell*>(left), right_cell = static_cast<Cell*>(right);
+            stack.emplace_back(left_cell->GetSecond().get(), right_cell->GetSecond().get());
+            stack.emplace_back(left_cell->GetFirst().get(), right_cell->GetFirst().get());
+        } else if (type == ObjectType::VECTOR) {
+            const auto& left_elements = static_cast<Vector*>(left)->GetElements();
+            const auto& right_elements = static_cast<Vector*>(right)->GetElements();
+            if (left_elements.size() != right_elements.size()) {
+                return false;
+            }
+            for (size_t i = left_elements.size(); i-- > 0;) {
+                stack.emplace_back(left_elements[i].get(), right_elements[i].get());
+            }
+        } else if (left->GetType() == ObjectType::STRING) {
+            if (static_cast<String*>(left)->GetValue() != static_cast<String*>(right)->GetValue()) {
+                return false;
+            }
+        } else if (!IsEqv(left->shared_from_this(), right->shared_from_this())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<Object>* HashTable::Find(const std::shared_ptr<Object>& key) {
+    if (!size_) {
+        return nullptr;
+    }
+    bool found;
+    auto index = Probe(key, Hash(key), &found);
+    return found ? &slots_[index].value : nullptr;
+}
+
+void HashTable::Set(const std::shared_ptr<Object>& key, std::shared_ptr<Object> value) {
+    // Keeps at least a quarter of the slots empty, so every probe ends.
+    if ((size_ + deleted_ + 1) * 4 > slots_.size() * 3) {
+        Rehash(std::max(kMinCapacity, std::bit_ceil((size_ + 1) * 2)));
+    }
+    auto hash = Hash(key);
+    bool found;
+    auto& slot = slots_[Probe(key, hash, &found)];
+    if (!found) {
+        deleted_ -= slot.state == SlotState::DELETED;
+        ++size_;
+        slot = {key, nullptr, hash, SlotState::FULL};
+    }
+    slot.value = std::move(value);
+}
+
+bool HashTable::Erase(const std::shared_ptr<Object>& key) {
+    if (!size_) {
+        return false;
+    }
+    bool found;
+    auto& slot = slots_[Probe(key, Hash(key), &found)];
+    if (!found) {
+        return false;
+    }
+    slot = {nullptr, nullptr, 0, SlotState::DELETED};
+    --size_;
+    ++deleted_;
+    return true;
+}
+
+uint64_t HashTable::Hash(const std::shared_ptr<Object>& key) const {
+    return equality_ == Equality::EQV ? HashEqv(key.get()) : HashEqual(key);
+}
+
+size_t HashTable::Probe(const std::shared_ptr<Object>& key, uint64_t hash, bool* found) const {
+    auto mask = slots_.size() - 1;
+    std::optional<size_t> free;
+    for (auto index = hash & mask;; index = (index + 1) & mask) {
+        const auto& slot = slots_[index];
+        if (slot.state == SlotState::EMPTY) {
+            *found = false;
+            return free.value_or(index);
+        }
+        if (slot.state == SlotState::DELETED) {
+            free = free.value_or(index);
+        } else if (slot.hash == hash && (equality_ == Equality::EQV ? IsEqv(slot.key, key)
+                                                                   : IsEqual(slot.key, key))) {
+            *found = true;
+            return index;
+        }
+    }
+}
+
+void HashTable::Rehash(size_t capacity) {
+    auto slots = std::exchange(slots_, std::vector<Slot>(capacity));
+    deleted_ = 0;
+    auto mask = capacity - 1;
+    for (auto& slot : slots) {
+        if (slot.state == SlotState::FULL) {
+            auto index = slot.hash & mask;
+            while (slots_[index].state != SlotState::EMPTY) {
+                index = (index + 1) & mask;
+            }
+            slots_[index] = std::move(slot);
+        }
+    }
+}
+
+void HashTable::Trace(Heap* heap) {
+    Object::Trace(heap);
+    ForEach([heap](const auto& key, const auto& value) {
+        heap->Mark(key.get());
+        heap->Mark(value.get());
+    });
+}
+
+void HashTable::Release() {
+    Object::Release();
+    slots_.clear();
+    size_ = deleted_ = 0;
 }
 
 Cell::Cell(std::shared_ptr<Object> first, std::shared_ptr<Object> second)
-    : first_(first), second_(second) {
+    : Object(kType), first_(first), second_(second) {
+}
+
+// Cells nobody else holds are taken apart here rather than by their own
+// destructors, so that dropping a long or deeply nested list doesn't recurse
+// once per cell.
+Cell::~Cell() {
+    auto is_last_cell = [](const std::shared_ptr<Object>& object) {
+        return Is<Cell>(object) && object.use_count() == 1;
+    };
+    if (!is_last_cell(first_) && !is_last_cell(second_)) {
+        return;
+    }
+    std::vector<std::shared_ptr<Object>> pending;
+    pending.push_back(std::move(first_));
+    pending.push_back(std::move(second_));
+    while (!pending.empty()) {
+        auto object = std::move(pending.back());
+        pending.pop_back();
+        if (is_last_cell(object)) {
+            auto cell = static_cast<Cell*>(object.get());
+            pending.push_back(std::move(cell->first_));
+            pending.push_back(std::move(cell->second_));
+        }
+    }
+}
+
+void Cell::Trace(Heap* heap) {
+    Object::Trace(heap);
+    heap->Mark(first_.get());
+    heap->Mark(second_.get());
+    if (call_site_cache_) {
+        heap->Mark(call_site_cache_->function.get());
+    }
+    if (body_cache_) {
+        heap->MarkShared(body_cache_->body);
+    }
+}
+
+void Cell::Release() {
+    Object::Release();
+    first_.reset();
+    second_.reset();
+    call_site_cache_.reset();
+    body_cache_.reset();
+}
+
+std::shared_ptr<IFunction> Cell::FindCallee(Scope* scope) {
+    auto function_scope = scope->GetFunctionScope();
+    auto epoch = Scope::GetDefinitionEpoch();
+    if (call_site_cache_ && call_site_cache_->epoch == epoch &&
+        call_site_cache_->function_scope == function_scope) {
+        return call_site_cache_->function;
+    }
+    auto function = function_scope->FindFunction(As<Symbol>(first_).get());
+    if (!call_site_cache_) {
+        call_site_cache_ = std::make_unique<CallSiteCache>();
+    }
+    *call_site_cache_ = {epoch, function_scope, function};
+    return function;
+}
+
+std::shared_ptr<const FunctionBody> Cell::PrepareBody(
+    const std::vector<std::shared_ptr<Symbol>>& args,
+    const std::vector<std::shared_ptr<Object>>& executables,
+    const std::shared_ptr<Scope>& scope) {
+    auto epoch = Scope::GetDefinitionEpoch();
+    auto function_scope = scope->GetFunctionScope();
+    if (body_cache_ && body_cache_->epoch == epoch &&
+        body_cache_->function_scope == function_scope &&
+        body_cache_->parent_layout == scope->GetLayout()) {
+        return body_cache_->body;
+    }
+    auto body = std::make_shared<const FunctionBody>(args, executables, scope);
+    body_cache_ = std::make_unique<BodyCache>(
+        BodyCache{epoch, function_scope, scope->GetLayout(), body});
+    return body;
+}
+
+// What the expansion calls may be defined anew at any time, so unlike function
+// bodies it isn't optimized.
+void Cell::Expand(Macro* macro) {
+    static const auto kBegin = Symbol::Intern("begin");
+    // A macro defined after the function holding the use was built sees the
+    // symbols the resolver replaced.
+    auto expansion = macro->Expand(Unresolve(shared_from_this()));
+    if (!Is<Cell>(expansion)) {
+        expansion = GetHeap().Make<Cell>(kBegin, GetHeap().Make<Cell>(expansion, nullptr));
+    }
+    first_ = As<Cell>(expansion)->first_;
+    second_ = As<Cell>(expansion)->second_;
+    call_site_cache_.reset();
 }
 
 std::shared_ptr<Object> Cell::Evaluate(std::shared_ptr<Scope> scope) {
+    return EvaluateTail(scope, nullptr);
+}
+
+std::shared_ptr<Object> Cell::EvaluateTail(std::shared_ptr<Scope> scope, TailCall* tail_call) {
+    if (Is<Symbol>(first_)) {
+        auto function = FindCallee(scope.get());
+        if (!function) {
+            throw NameError("Unknown function: " + As<Symbol>(first_)->GetName());
+        }
+        if (function->IsMacro()) {
+            Expand(static_cast<Macro*>(function.get()));
+            return EvaluateTail(scope, tail_call);
+        }
+        return scope->CallFunction(function, second_, scope, tail_call);
+    }
     auto lhs = first_;
-    while (!Is<Number>(lhs) && !Is<Symbol>(lhs) && !Is<FunctionObject>(lhs)) {
+    while (!lhs || Is<Cell>(lhs)) {
         lhs = ::Evaluate(lhs, scope);
     }
-    return scope->CallFunction(lhs, second_, scope);
+    return scope->CallFunction(lhs, second_, scope, tail_call);
 }
\ No newline at end of file
@@ -1,21 +1,83 @@
 #pragma once
 
+#include <atomic>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <span>
 #include <utility>
 #include <string>
-#include <set>
-#include <map>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "big_integer.h"
 #include "error.h"
+#include "heap.h"
+#include "metrics.h"
+#include "optimizer.h"
+#include "resolver.h"
 
 class Scope;
+class Number;
+class Symbol;
+class FunctionObject;
+class UserFunction;
+class Macro;
+struct Chunk;
+
+// A call in tail position, left for the enclosing UserFunction::Execute to
+// make so that tail-recursive loops don't grow the native stack.
+struct TailCall {
+    std::shared_ptr<UserFunction> function;
+    std::shared_ptr<Object> args;
+    std::shared_ptr<Scope> scope;
+};
+
+enum class ObjectType : uint8_t {
+    NUMBER,
+    SYMBOL,
+    REFERENCE,
+    CELL,
+    FUNCTION,
+    VECTOR,
+    HASH_TABLE,
+    STRING,
+    STRING_PORT,
+};
 
-class Object : public std::enable_shared_from_this<Object> {
+class Object : public std::enable_shared_from_this<Object>, public HeapObject {
 public:
+    explicit Object(ObjectType type) : type_(type) {
+    }
     virtual ~Object() = default;
+    ObjectType GetType() const {
+        return type_;
+    }
     virtual std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope) = 0;
+    // Either evaluates the object or stores the call it ends with in tail_call.
+    virtual std::shared_ptr<Object> EvaluateTail(std::shared_ptr<Scope> scope, TailCall*) {
+        return Evaluate(scope);
+    }
+    void Trace(Heap* heap) override;
+    void Release() override;
+    // Set on cells only: numbers and symbols may be shared permanent objects.
     std::shared_ptr<Scope> object_scope;
+
+    // Marks an object stored into an existing structure. That is the only way
+    // an object can be reached along two paths, so only these need cycle and
+    // sharing checks when printed.
+    void MarkAliased() {
+        is_aliased_ = true;
+    }
+    bool IsAliased() const {
+        return is_aliased_;
+    }
+
+private:
+    const ObjectType type_;
+    bool is_aliased_ = false;
 };
 
 template <class T>
@@ -25,73 +87,279 @@ template <class T>
 bool Is(const std::shared_ptr<Object>& obj);
 
 std::shared_ptr<Object> Evaluate(std::shared_ptr<Object> object, std::shared_ptr<Scope> scope);
+std::shared_ptr<Object> EvaluateTail(std::shared_ptr<Object> object, std::shared_ptr<Scope> scope,
+                                     TailCall* tail_call);
 
-class IFunction : public std::enable_shared_from_this<IFunction> {
+class IFunction : public std::enable_shared_from_this<IFunction>, public HeapObject {
 public:
     virtual std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                             std::shared_ptr<Scope> scope) = 0;
+    virtual std::shared_ptr<Object> ExecuteTail(std::shared_ptr<Object> object,
+                                                std::shared_ptr<Scope> scope, TailCall*) {
+        return Execute(object, scope);
+    }
+    // Applies the function to already evaluated arguments. Only builtins which
+    // evaluate each of their arguments once, left to right, support it.
+    virtual std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args);
+    // Whether a call neither changes any state nor depends on anything but
+    // the values of its arguments.
+    virtual bool IsPure() {
+        return false;
+    }
     virtual ~IFunction() = default;
+
+    // The value of the function's name. All references share one wrapper for
+    // as long as any of them is alive.
+    std::shared_ptr<FunctionObject> GetFunctionObject();
+
+    // Counters of the builtin registered under this function, null otherwise.
+    BuiltinStats* GetBuiltinStats() const {
+        return builtin_stats_;
+    }
+    void SetBuiltinStats(BuiltinStats* stats) {
+        builtin_stats_ = stats;
+    }
+
+    // Macros are expanded by the form using them instead of being called.
+    bool IsMacro() const {
+        return is_macro_;
+    }
+
+protected:
+    void MarkMacro() {
+        is_macro_ = true;
+    }
+
+private:
+    std::weak_ptr<FunctionObject> function_object_;
+    BuiltinStats* builtin_stats_ = nullptr;
+    bool is_macro_ = false;
+};
+
+// Counters of a memoized function, as returned by memo-stats.
+struct MemoStats {
+    bool is_pure = false;
+    size_t hits = 0, misses = 0, size = 0;
+};
+
+// The body of a user function as it runs: optimized and with its variables
+// resolved. Functions made by the same lambda or define form share it, see
+// Cell::PrepareBody.
+struct FunctionBody {
+    // Optimizes and resolves `source` for frames on top of `parent_scope`.
+    FunctionBody(std::vector<std::shared_ptr<Symbol>> args,
+                 std::vector<std::shared_ptr<Object>> source,
+                 const std::shared_ptr<Scope>& parent_scope);
+    void Trace(Heap* heap) const;
+
+    std::vector<std::shared_ptr<Symbol>> args;
+    std::vector<std::shared_ptr<Object>> source, executables;
+    std::shared_ptr<const FrameLayout> layout;
+    FoldedCalls folded;
+    // Compiled on first use. Guards make the chunk right for any frame with
+    // this layout.
+    mutable std::shared_ptr<const Chunk> chunk;
 };
 
 class UserFunction : public IFunction {
 public:
-    UserFunction(const std::vector<std::string>& args,
-                 const std::vector<std::shared_ptr<Object>>& executables,
-                 std::shared_ptr<Scope> parent_scope)
-        : args_(args), executables_(executables), parent_scope_(parent_scope) {
+    UserFunction(std::shared_ptr<const FunctionBody> body, std::shared_ptr<Scope> parent_scope)
+        : body_(std::move(body)), parent_scope_(std::move(parent_scope)) {
     }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> ExecuteTail(std::shared_ptr<Object> object,
+                                        std::shared_ptr<Scope> scope,
+                                        TailCall* tail_call) override;
+    void Trace(Heap* heap) override;
+    void Release() override;
+
+    size_t GetArgCount() const {
+        return body_->args.size();
+    }
+    const std::shared_ptr<const FrameLayout>& GetLayout() const {
+        return body_->layout;
+    }
+    std::shared_ptr<Scope> CreateFrame();
+    const std::shared_ptr<const Chunk>& GetChunk();
+    // The name the function was first defined under, "lambda" until then.
+    const Symbol* GetName() const;
+    bool HasName() const {
+        return name_;
+    }
+    void SetName(const Symbol* name) {
+        name_ = name;
+    }
+
+    // Decided again whenever a function is defined, since that can change
+    // what the body calls.
+    bool IsPure() override;
+    // Makes calls of a pure function with atomic arguments look up their
+    // results first. Lists and vectors can change under a key or in a result,
+    // so calls with those are never cached.
+    void EnableMemoization();
+    bool IsMemoized() const {
+        return memo_ != nullptr;
+    }
+    // Returns nullptr on a miss and for calls that aren't cached.
+    std::shared_ptr<Object> FindMemoized(std::span<const std::shared_ptr<Object>> args);
+    void StoreMemoized(std::span<const std::shared_ptr<Object>> args,
+                       std::shared_ptr<Object> result);
+    MemoStats GetMemoStats();
 
 private:
-    std::vector<std::string> args_;
-    std::vector<std::shared_ptr<Object>> executables_;
+    struct Memo;
+
+    // Stores the evaluated arguments in `values` if it isn't null.
+    std::shared_ptr<Scope> BindArguments(std::shared_ptr<Object> object,
+                                         std::shared_ptr<Scope> scope,
+                                         std::vector<std::shared_ptr<Object>>* values = nullptr);
+    // The body, prepared again from its source once a call folded in it
+    // resolves to another function.
+    const std::shared_ptr<const FunctionBody>& GetBody();
+    bool IsPureBody(std::unordered_set<const UserFunction*>* assumed);
+    // The results of memoized calls, dropped once a function the body calls,
+    // directly or not, is defined anew.
+    Memo* GetMemo();
+
+    std::shared_ptr<const FunctionBody> body_;
     std::shared_ptr<Scope> parent_scope_;
+    const Symbol* name_ = nullptr;
+    std::shared_ptr<Memo> memo_;
+    uint64_t body_epoch_ = std::numeric_limits<uint64_t>::max();
+    uint64_t purity_epoch_ = std::numeric_limits<uint64_t>::max();
+    bool is_pure_ = false;
 };
 
-class Scope : public std::enable_shared_from_this<Scope> {
+class Scope : public std::enable_shared_from_this<Scope>, public HeapObject {
 public:
-    std::shared_ptr<Object> AddFunction(const std::string& name, std::shared_ptr<IFunction> func);
-    std::shared_ptr<Object> AddVariable(const std::string& name, std::shared_ptr<Object> variable);
-    std::shared_ptr<Object> UpdateVariable(const std::string& name,
-                                           std::shared_ptr<Object> variable);
+    std::shared_ptr<Object> AddFunction(std::shared_ptr<Symbol> name,
+                                        std::shared_ptr<IFunction> func);
+    std::shared_ptr<Object> AddVariable(const std::shared_ptr<Symbol>& name,
+                                        std::shared_ptr<Object> variable);
+    std::shared_ptr<Object> UpdateVariable(const Symbol* name, std::shared_ptr<Object> variable);
     void AddParentScope(std::shared_ptr<Scope> parent_scope);
+    const std::shared_ptr<Scope>& GetParentScope() const {
+        return parent_scope_;
+    }
+    void SetLayout(std::shared_ptr<const FrameLayout> layout);
+    const std::shared_ptr<const FrameLayout>& GetLayout() const {
+        return layout_;
+    }
+    void SetSlot(size_t slot, std::shared_ptr<Object> variable);
     std::shared_ptr<Object> CallFunction(std::shared_ptr<Object> func,
                                          std::shared_ptr<Object> object,
-                                         std::shared_ptr<Scope> scope);
-    std::shared_ptr<Object> GetVariable(const std::string& name);
-    std::shared_ptr<IFunction> GetFunction(const std::string& name);
-    bool IsFunctionExists(const std::string& name);
+                                         std::shared_ptr<Scope> scope,
+                                         TailCall* tail_call = nullptr);
+    std::shared_ptr<Object> CallFunction(const std::shared_ptr<IFunction>& function,
+                                         std::shared_ptr<Object> object,
+                                         std::shared_ptr<Scope> scope,
+                                         TailCall* tail_call = nullptr);
+    std::shared_ptr<Object> GetVariable(const Symbol* name);
+    std::shared_ptr<Object> GetVariable(const Symbol* name, LexicalAddress address);
+    std::shared_ptr<Object> UpdateVariable(const Symbol* name, LexicalAddress address,
+                                           std::shared_ptr<Object> variable);
+    std::shared_ptr<IFunction> GetFunction(const Symbol* name);
+    std::shared_ptr<IFunction> FindFunction(const Symbol* name);
+    bool IsFunctionExists(const Symbol* name);
+    // Makes each alias in `aliases` name what its name names here, now and
+    // after every later definition of the name in this scope, in place of the
+    // aliases of the previous definition of `keyword`. Only a global scope
+    // keeps aliases, since a local one is created anew by every call.
+    bool SetAliases(const Symbol* keyword,
+                    const std::unordered_map<const Symbol*, std::shared_ptr<Symbol>>& aliases);
+    // The nearest scope up the chain that defines any functions. Together with
+    // the definition epoch it determines what every function name resolves to.
+    Scope* GetFunctionScope();
+    // Bumped by every function definition.
+    static uint64_t GetDefinitionEpoch();
     void CreateGlobalScope();
+    void Trace(Heap* heap) override;
+    void Release() override;
 
 private:
-    std::map<std::string, std::shared_ptr<Object>> variables_;
-    std::map<std::string, std::shared_ptr<IFunction>> functions_;
+    struct Slot {
+        std::shared_ptr<Object> value;
+        bool bound = false;
+    };
+
+    void AddBuiltin(const std::string& name, std::shared_ptr<IFunction> func);
+    std::shared_ptr<Object>* FindVariable(const Symbol* name, LexicalAddress address);
+    std::shared_ptr<Object>* LookupVariable(const Symbol* name);
+    void KeepName(const std::shared_ptr<Symbol>& name);
+
+    std::shared_ptr<const FrameLayout> layout_;
+    std::vector<Slot> slots_;
+    std::unordered_map<const Symbol*, std::shared_ptr<Object>> variables_;
+    std::unordered_map<const Symbol*, std::shared_ptr<IFunction>> functions_;
+    // The names defined here which aren't interned, kept so that no other
+    // symbol takes their place in the maps.
+    std::vector<std::shared_ptr<Symbol>> renamed_;
     std::shared_ptr<Scope> parent_scope_, global_scope_;
-    std::set<std::string> all_functions_;
+    std::unordered_set<const Symbol*> all_functions_;
+    // The aliases of each name, by the keyword of the macro using them.
+    std::unordered_map<const Symbol*, std::unordered_map<const Symbol*, std::shared_ptr<Symbol>>>
+        aliases_;
 };
 
 class ArithmeticFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
 
 protected:
-    virtual int64_t Operation(int64_t lhs, int64_t rhs) = 0;
+    // Returns false if the result doesn't fit into a fixnum.
+    virtual bool Operation(int64_t lhs, int64_t rhs, int64_t* ans) = 0;
+    virtual BigInteger Operation(const BigInteger& lhs, const BigInteger& rhs) = 0;
     virtual int64_t GetDefaultValue() = 0;
+
+private:
+    // A running result which stays a fixnum until an operation overflows.
+    struct Accumulator {
+        Accumulator() = default;
+        explicit Accumulator(const Number& first);
+
+        int64_t fixnum = 0;
+        std::optional<BigInteger> big;
+    };
+
+    void Accumulate(Accumulator* ans, const Number& rhs);
 };
 
 class ComparisonFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
 
 protected:
     virtual int64_t Compare(int64_t lhs, int64_t rhs) = 0;
+
+private:
+    bool CompareNumbers(const Number& lhs, const Number& rhs);
+};
+
+// A builtin which evaluates each of its arguments once, left to right, and
+// only then looks at them, so compiled code can apply it directly.
+class StrictFunction : public IFunction {
+public:
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
+                                    std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override = 0;
 };
 
 class BooleanFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
 
@@ -101,6 +369,9 @@ protected:
 
 class OneArgumentFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
 
@@ -163,6 +434,24 @@ private:
                                      std::shared_ptr<Scope> scope) override;
 };
 
+class IsHashTableFunction : public OneArgumentFunction {
+protected:
+    std::shared_ptr<Object> Function(std::shared_ptr<Object> object,
+                                     std::shared_ptr<Scope> scope) override;
+};
+
+class IsStringFunction : public OneArgumentFunction {
+protected:
+    std::shared_ptr<Object> Function(std::shared_ptr<Object> object,
+                                     std::shared_ptr<Scope> scope) override;
+};
+
+class IsVectorFunction : public OneArgumentFunction {
+protected:
+    std::shared_ptr<Object> Function(std::shared_ptr<Object> object,
+                                     std::shared_ptr<Scope> scope) override;
+};
+
 class GetFirstElementFunction : public OneArgumentFunction {
 protected:
     std::shared_ptr<Object> Function(std::shared_ptr<Object> object,
@@ -177,32 +466,63 @@ protected:
 
 class GetElementFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
 };
 
 class GetTailFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
 };
 
 class ConstructPairFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
 };
 
 class ConstructListFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
 };
 
 class IfFunction : public IFunction {
 public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
+                                    std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> ExecuteTail(std::shared_ptr<Object> object,
+                                        std::shared_ptr<Scope> scope,
+                                        TailCall* tail_call) override;
+};
+
+// Evaluates its arguments in order and returns the last one, in tail position.
+class BeginFunction : public IFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> ExecuteTail(std::shared_ptr<Object> object,
+                                        std::shared_ptr<Scope> scope,
+                                        TailCall* tail_call) override;
 };
 
 class DefineFunction : public IFunction {
@@ -229,12 +549,228 @@ public:
                                     std::shared_ptr<Scope> scope) override;
 };
 
+// (define-memoized (name args...) body...) defines a function whose results
+// are remembered while it is pure.
+class DefineMemoizedFunction : public DefineFunction {
+public:
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
+                                    std::shared_ptr<Scope> scope) override;
+};
+
+// (define-syntax name (syntax-rules ...)) defines a macro in the function namespace.
+class DefineSyntaxFunction : public IFunction {
+public:
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
+                                    std::shared_ptr<Scope> scope) override;
+};
+
+class MemoStatsFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
 class LambdaFunction : public IFunction {
 public:
     std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
                                     std::shared_ptr<Scope> scope) override;
 };
 
+class GcFunction : public IFunction {
+public:
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
+                                    std::shared_ptr<Scope> scope) override;
+};
+
+class GcStatsFunction : public IFunction {
+public:
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
+                                    std::shared_ptr<Scope> scope) override;
+};
+
+class RuntimeStatsFunction : public IFunction {
+public:
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> object,
+                                    std::shared_ptr<Scope> scope) override;
+};
+
+class MakeVectorFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class ConstructVectorFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class VectorRefFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class VectorSetFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class VectorLengthFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class VectorToListFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class ListToVectorFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class IsEqFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class IsEqualFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class MakeHashTableFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class HashTableRefFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class HashTableSetFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class HashTableDeleteFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class HashTableContainsFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class HashTableCountFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class HashTableKeysFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class HashTableValuesFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class HashTableToAlistFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class StringLengthFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class StringAppendFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class SubstringFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class IsStringEqualFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class StringToSymbolFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class SymbolToStringFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class NumberToStringFunction : public StrictFunction {
+public:
+    bool IsPure() override {
+        return true;
+    }
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class OpenOutputStringFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class WriteStringFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class DisplayFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
+class GetOutputStringFunction : public StrictFunction {
+public:
+    std::shared_ptr<Object> Apply(std::span<const std::shared_ptr<Object>> args) override;
+};
+
 class AndFunction : public BooleanFunction {
 protected:
     bool GetDefaultValue() override {
@@ -251,7 +787,10 @@ protected:
 
 class SumFunction : public ArithmeticFunction {
 protected:
-    int64_t Operation(int64_t lhs, int64_t rhs) override {
+    bool Operation(int64_t lhs, int64_t rhs, int64_t* ans) override {
+        return !__builtin_add_overflow(lhs, rhs, ans);
+    }
+    BigInteger Operation(const BigInteger& lhs, const BigInteger& rhs) override {
         return lhs + rhs;
     }
     int64_t GetDefaultValue() override {
@@ -261,7 +800,10 @@ protected:
 
 class SubtractFunction : public ArithmeticFunction {
 protected:
-    int64_t Operation(int64_t lhs, int64_t rhs) override {
+    bool Operation(int64_t lhs, int64_t rhs, int64_t* ans) override {
+        return !__builtin_sub_overflow(lhs, rhs, ans);
+    }
+    BigInteger Operation(const BigInteger& lhs, const BigInteger& rhs) override {
         return lhs - rhs;
     }
     int64_t GetDefaultValue() override {
@@ -271,7 +813,10 @@ protected:
 
 class MultiplyFunction : public ArithmeticFunction {
 protected:
-    int64_t Operation(int64_t lhs, int64_t rhs) override {
+    bool Operation(int64_t lhs, int64_t rhs, int64_t* ans) override {
+        return !__builtin_mul_overflow(lhs, rhs, ans);
+    }
+    BigInteger Operation(const BigInteger& lhs, const BigInteger& rhs) override {
         return lhs * rhs;
     }
     int64_t GetDefaultValue() override {
@@ -281,7 +826,20 @@ protected:
 
 class DivideFunction : public ArithmeticFunction {
 protected:
-    int64_t Operation(int64_t lhs, int64_t rhs) override {
+    bool Operation(int64_t lhs, int64_t rhs, int64_t* ans) override {
+        if (rhs == 0) {
+            throw RuntimeError("Division by zero");
+        }
+        if (lhs == std::numeric_limits<int64_t>::min() && rhs == -1) {
+            return false;
+        }
+        *ans = lhs / rhs;
+        return true;
+    }
+    BigInteger Operation(const BigInteger& lhs, const BigInteger& rhs) override {
+        if (rhs.IsZero()) {
+            throw RuntimeError("Division by zero");
+        }
         return lhs / rhs;
     }
     int64_t GetDefaultValue() override {
@@ -291,8 +849,12 @@ protected:
 
 class MaxFunction : public ArithmeticFunction {
 protected:
-    int64_t Operation(int64_t lhs, int64_t rhs) override {
-        return std::max(lhs, rhs);
+    bool Operation(int64_t lhs, int64_t rhs, int64_t* ans) override {
+        *ans = std::max(lhs, rhs);
+        return true;
+    }
+    BigInteger Operation(const BigInteger& lhs, const BigInteger& rhs) override {
+        return lhs.Compare(rhs) >= 0 ? lhs : rhs;
     }
     int64_t GetDefaultValue() override {
         throw RuntimeError("Max hasn't default value");
@@ -301,8 +863,12 @@ protected:
 
 class MinFunction : public ArithmeticFunction {
 protected:
-    int64_t Operation(int64_t lhs, int64_t rhs) override {
-        return std::min(lhs, rhs);
+    bool Operation(int64_t lhs, int64_t rhs, int64_t* ans) override {
+        *ans = std::min(lhs, rhs);
+        return true;
+    }
+    BigInteger Operation(const BigInteger& lhs, const BigInteger& rhs) override {
+        return lhs.Compare(rhs) <= 0 ? lhs : rhs;
     }
     int64_t GetDefaultValue() override {
         throw RuntimeError("Min hasn't default value");
@@ -346,7 +912,10 @@ protected:
 
 class FunctionObject : public Object {
 public:
-    explicit FunctionObject(std::shared_ptr<IFunction> function) : function_(function) {
+    static constexpr ObjectType kType = ObjectType::FUNCTION;
+
+    explicit FunctionObject(std::shared_ptr<IFunction> function)
+        : Object(kType), function_(function) {
     }
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope>) override {
         return this->shared_from_this();
@@ -354,6 +923,14 @@ public:
     std::shared_ptr<IFunction> GetFunction() {
         return function_;
     }
+    void Trace(Heap* heap) override {
+        Object::Trace(heap);
+        heap->Mark(function_.get());
+    }
+    void Release() override {
+        Object::Release();
+        function_.reset();
+    }
 
 private:
     std::shared_ptr<IFunction> function_;
@@ -361,43 +938,132 @@ private:
 
 class Number : public Object {
 public:
-    explicit Number(int value) : value_(value) {
+    static constexpr ObjectType kType = ObjectType::NUMBER;
+
+    explicit Number(int64_t value) : Object(kType), value_(value) {
+    }
+    explicit Number(BigInteger value)
+        : Object(kType), value_(0), big_(std::make_unique<BigInteger>(std::move(value))) {
     }
-    int GetValue() const {
+    // Small values are preallocated and shared, larger ones are allocated on
+    // the heap.
+    static std::shared_ptr<Number> Make(int64_t value);
+    // Makes a fixnum if the value fits into one.
+    static std::shared_ptr<Number> Make(BigInteger value);
+
+    // Every value that fits into int64_t is a fixnum; only those have GetValue.
+    bool IsFixnum() const {
+        return !big_;
+    }
+    int64_t GetValue() const {
         return value_;
     }
+    BigInteger ToBigInteger() const {
+        return big_ ? *big_ : BigInteger(value_);
+    }
+    std::string ToString() const {
+        return big_ ? big_->ToString() : std::to_string(value_);
+    }
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope>) override {
         return this->shared_from_this();
     }
 
 private:
-    int value_;
+    int64_t value_;
+    std::unique_ptr<const BigInteger> big_;
 };
 
+// Symbols are interned: every name has exactly one instance, so symbols are
+// compared and used as scope keys by pointer.
 class Symbol : public Object {
 public:
-    explicit Symbol(const std::string& name) : name_(name) {
+    static constexpr ObjectType kType = ObjectType::SYMBOL;
+
+    explicit Symbol(const std::string& name) : Object(kType), name_(name) {
+    }
+    // A symbol which isn't interned, so that no other symbol equals it. It
+    // goes with its last owner, unlike an interned one.
+    Symbol(const std::string& name, const Symbol* origin)
+        : Object(kType), name_(name), origin_(origin->GetOrigin()) {
     }
+    static std::shared_ptr<Symbol> Intern(std::string_view name);
+    static const std::shared_ptr<Symbol>& True();
+    static const std::shared_ptr<Symbol>& False();
+
     const std::string& GetName() const {
         return name_;
     }
+    // The interned symbol an uninterned one was made from, the symbol itself
+    // otherwise.
+    const Symbol* GetOrigin() const {
+        return origin_ ? origin_ : this;
+    }
+    bool IsBool() const {
+        return this == True().get() || this == False().get();
+    }
+    // Whether a function was ever defined under the name, in any scope. Names
+    // which never were can't be shadowed by a function, see
+    // Scope::IsFunctionExists.
+    bool IsFunctionName() const {
+        return is_function_name_.load(std::memory_order_relaxed);
+    }
+    void MarkFunctionName() const {
+        is_function_name_.store(true, std::memory_order_relaxed);
+    }
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope) override {
-        if (name_ == "#t" || name_ == "#f") {
+        if (IsBool()) {
             return this->shared_from_this();
         }
-        if (scope->IsFunctionExists(name_)) {
-            return std::make_shared<FunctionObject>(scope->GetFunction(name_));
+        if (scope->IsFunctionExists(this)) {
+            return scope->GetFunction(this)->GetFunctionObject();
         }
-        return scope->GetVariable(name_);
+        return scope->GetVariable(this);
     }
 
 private:
     std::string name_;
+    const Symbol* origin_ = nullptr;
+    mutable std::atomic<bool> is_function_name_ = false;
+};
+
+// A variable a function body evaluates, with its address relative to the
+// frame of the function, see ResolveFunction. Like a symbol, it names a
+// function first if there is one.
+class Reference : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::REFERENCE;
+
+    Reference(std::shared_ptr<Symbol> name, LexicalAddress address)
+        : Object(kType), name_(std::move(name)), address_(address) {
+    }
+    const std::shared_ptr<Symbol>& GetName() const {
+        return name_;
+    }
+    LexicalAddress GetAddress() const {
+        return address_;
+    }
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope) override {
+        if (scope->IsFunctionExists(name_.get())) {
+            return GetHeap().Make<FunctionObject>(scope->GetFunction(name_.get()));
+        }
+        return scope->GetVariable(name_.get(), address_);
+    }
+    void Trace(Heap* heap) override {
+        Object::Trace(heap);
+        heap->Mark(name_.get());
+    }
+
+private:
+    std::shared_ptr<Symbol> name_;
+    LexicalAddress address_;
 };
 
 class Cell : public Object {
 public:
+    static constexpr ObjectType kType = ObjectType::CELL;
+
     explicit Cell(std::shared_ptr<Object> first, std::shared_ptr<Object> second);
+    ~Cell() override;
     std::shared_ptr<Object>& GetFirst() {
         return first_;
     }
@@ -406,22 +1072,184 @@ public:
     }
 
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> EvaluateTail(std::shared_ptr<Scope> scope,
+                                         TailCall* tail_call) override;
+    void Trace(Heap* heap) override;
+    void Release() override;
+
+    // Resolves the function named by the head of a call, remembering the
+    // answer until a function is defined or the call runs in another scope.
+    // Returns nullptr if there is no such function.
+    std::shared_ptr<IFunction> FindCallee(Scope* scope);
+    // The body of a function with `args` and `executables`, which the cell
+    // holds for a lambda or define form, to run in frames on top of `scope`.
+    // It is prepared once for all the frames on top of scopes with the same
+    // layout and functions, until a function is defined.
+    std::shared_ptr<const FunctionBody> PrepareBody(
+        const std::vector<std::shared_ptr<Symbol>>& args,
+        const std::vector<std::shared_ptr<Object>>& executables,
+        const std::shared_ptr<Scope>& scope);
+    // Replaces the use of a macro the cell holds with its expansion, so that
+    // it is expanded only once. An expansion which isn't a call is wrapped
+    // into begin.
+    void Expand(Macro* macro);
 
 private:
+    struct CallSiteCache {
+        uint64_t epoch;
+        Scope* function_scope;
+        std::shared_ptr<IFunction> function;
+    };
+
+    struct BodyCache {
+        uint64_t epoch;
+        Scope* function_scope;
+        std::shared_ptr<const FrameLayout> parent_layout;
+        std::shared_ptr<const FunctionBody> body;
+    };
+
     std::shared_ptr<Object> first_, second_;
+    std::unique_ptr<CallSiteCache> call_site_cache_;
+    std::unique_ptr<BodyCache> body_cache_;
+};
+
+// Fixed-size array whose elements live in one contiguous buffer. Vectors
+// evaluate to themselves.
+class Vector : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::VECTOR;
+
+    explicit Vector(std::vector<std::shared_ptr<Object>> elements)
+        : Object(kType), elements_(std::move(elements)) {
+    }
+    std::vector<std::shared_ptr<Object>>& GetElements() {
+        return elements_;
+    }
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope>) override {
+        return this->shared_from_this();
+    }
+    void Trace(Heap* heap) override;
+    void Release() override;
+
+private:
+    std::vector<std::shared_ptr<Object>> elements_;
+};
+
+// Immutable byte string. std::string keeps short ones inline, without a
+// separate allocation.
+class String : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::STRING;
+
+    explicit String(std::string value) : Object(kType), value_(std::move(value)) {
+    }
+    const std::string& GetValue() const {
+        return value_;
+    }
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope>) override {
+        return this->shared_from_this();
+    }
+
+private:
+    std::string value_;
+};
+
+// Output port that collects text in a growing buffer, so building a string
+// piece by piece takes amortized linear time.
+class StringPort : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::STRING_PORT;
+
+    StringPort() : Object(kType) {
+    }
+    std::string& GetBuffer() {
+        return buffer_;
+    }
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope>) override {
+        return this->shared_from_this();
+    }
+
+private:
+    std::string buffer_;
+};
+
+// eq? compares numbers by value and everything else by identity. equal? also
+// compares strings by contents, and lists and vectors element by element.
+bool IsEqv(const std::shared_ptr<Object>& lhs, const std::shared_ptr<Object>& rhs);
+bool IsEqual(const std::shared_ptr<Object>& lhs, const std::shared_ptr<Object>& rhs);
+
+// Builtins which evaluate every argument as an expression. Quote, list and
+// cons return their arguments as data, list-ref and list-tail take a literal
+// index and macros see their arguments as syntax, so none of them does.
+bool EvaluatesArguments(IFunction* function);
+
+// Open-addressing hash table with linear probing over a power-of-two number of
+// slots. Deleted slots stay as tombstones until the next rehash.
+class HashTable : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::HASH_TABLE;
+    static constexpr size_t kMinCapacity = 8;
+
+    enum class Equality { EQV, EQUAL };
+
+    explicit HashTable(Equality equality) : Object(kType), equality_(equality) {
+    }
+    // Returns nullptr if there is no such key.
+    std::shared_ptr<Object>* Find(const std::shared_ptr<Object>& key);
+    void Set(const std::shared_ptr<Object>& key, std::shared_ptr<Object> value);
+    // Returns false if there was no such key.
+    bool Erase(const std::shared_ptr<Object>& key);
+    size_t GetSize() const {
+        return size_;
+    }
+    template <class F>
+    void ForEach(F&& function) const {
+        for (const auto& slot : slots_) {
+            if (slot.state == SlotState::FULL) {
+                function(slot.key, slot.value);
+            }
+        }
+    }
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope>) override {
+        return this->shared_from_this();
+    }
+    void Trace(Heap* heap) override;
+    void Release() override;
+
+private:
+    enum class SlotState : uint8_t { EMPTY, FULL, DELETED };
+
+    struct Slot {
+        std::shared_ptr<Object> key, value;
+        uint64_t hash = 0;
+        SlotState state = SlotState::EMPTY;
+    };
+
+    uint64_t Hash(const std::shared_ptr<Object>& key) const;
+    // Returns the slot holding the key, or else the first free slot on its
+    // probe sequence.
+    size_t Probe(const std::shared_ptr<Object>& key, uint64_t hash, bool* found) const;
+    void Rehash(size_t capacity);
+
+    Equality equality_;
+    std::vector<Slot> slots_;
+    size_t size_ = 0, deleted_ = 0;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
 // Runtime type checking and convertion.
-// This can be helpful: https://en.cppreference.com/w/cpp/memory/shared_ptr/pointer_cast
+// Every concrete object type has its own tag, so a tag check is enough.
 
 template <class T>
 std::shared_ptr<T> As(const std::shared_ptr<Object>& obj) {
-    return std::dynamic_pointer_cast<T>(obj);
+    if (!Is<T>(obj)) {
+        return nullptr;
+    }
+    return std::static_pointer_cast<T>(obj);
 }
 
 template <class T>
 bool Is(const std::shared_ptr<Object>& obj) {
-    return std::dynamic_pointer_cast<T>(obj) != nullptr;
+    return obj && obj->GetType() == T::kType;
 }
@@ -0,0 +1,224 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "metrics.h"
+#include "object.h"
+#include "serializer.h"
+
+namespace {
+
+std::atomic<std::ostream*> dump_stream = nullptr;
+std::mutex dump_mutex;
+
+using Names = std::unordered_set<const Symbol*>;
+
+// Targets of every define in the form, including nested function bodies, may
+// shadow a builtin by the time the code runs. Lambdas are optimized with the
+// scope they are created in and quoted data is never run, so neither is
+// searched.
+void CollectDefinitions(const std::shared_ptr<Object>& form, Names* names) {
+    static const auto kQuote = Symbol::Intern("quote");
+    static const auto kLambda = Symbol::Intern("lambda");
+    static const auto kDefine = Symbol::Intern("define");
+    static const auto kDefineMemoized = Symbol::Intern("define-memoized");
+    static const auto kDefineSyntax = Symbol::Intern("define-syntax");
+    if (!Is<Cell>(form)) {
+        return;
+    }
+    auto head = As<Cell>(form)->GetFirst();
+    if (head == kQuote || head == kLambda) {
+        return;
+    }
+    if ((head == kDefine || head == kDefineMemoized || head == kDefineSyntax) &&
+        Is<Cell>(As<Cell>(form)->GetSecond())) {
+        auto target = As<Cell>(As<Cell>(form)->GetSecond())->GetFirst();
+        if (Is<Cell>(target)) {
+            target = As<Cell>(target)->GetFirst();
+        }
+        if (Is<Symbol>(target)) {
+            names->insert(As<Symbol>(target).get());
+        }
+    }
+    for (auto rest = form; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+        CollectDefinitions(As<Cell>(rest)->GetFirst(), names);
+    }
+}
+
+// Objects which evaluate to themselves and can't be changed.
+bool IsConstant(const std::shared_ptr<Object>& object) {
+    return Is<Number>(object) || Is<String>(object) ||
+           (Is<Symbol>(object) && As<Symbol>(object)->IsBool());
+}
+
+bool IsFalse(const std::shared_ptr<Object>& object) {
+    return object == Symbol::False();
+}
+
+class Optimizer {
+public:
+    Optimizer(const std::shared_ptr<Scope>& scope, Names defined, FoldedCalls* folded = nullptr)
+        : scope_(scope), defined_(std::move(defined)), folded_(folded) {
+    }
+
+    std::shared_ptr<Object> Run(const std::shared_ptr<Object>& form) {
+        auto optimized = OptimizeExpression(form);
+        if (optimized != form) {
+            if (auto out = dump_stream.load(std::memory_order_relaxed)) {
+                std::lock_guard lock(dump_mutex);
+                Serialize(form, out);
+                *out << " => ";
+                Serialize(optimized, out);
+                *out << '\n';
+            }
+        }
+        return optimized;
+    }
+
+private:
+    std::shared_ptr<Object> OptimizeExpression(const std::shared_ptr<Object>& form) {
+        if (!Is<Cell>(form) || !Is<Symbol>(As<Cell>(form)->GetFirst())) {
+            return form;
+        }
+        auto name = As<Symbol>(As<Cell>(form)->GetFirst());
+        std::vector<std::shared_ptr<Object>> args;
+        auto rest = As<Cell>(form)->GetSecond();
+        for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+            args.push_back(As<Cell>(rest)->GetFirst());
+        }
+        if (rest || defined_.contains(name.get())) {
+            return form;
+        }
+        auto function = scope_->FindFunction(name.get());
+        // A function which isn't defined yet may turn out to be a macro.
+        if (!function) {
+            return form;
+        }
+        if (dynamic_cast<QuoteFunction*>(function.get())) {
+            if (args.size() != 1 || (!IsConstant(args[0]) && !Is<Vector>(args[0]))) {
+                return form;
+            }
+            Fold(name, function);
+            return args[0];
+        }
+        if (dynamic_cast<IfFunction*>(function.get())) {
+            return OptimizeIf(form, std::move(args), name, function);
+        }
+        if (dynamic_cast<DefineFunction*>(function.get()) ||
+            dynamic_cast<SetFunction*>(function.get())) {
+            // Only the value of a variable definition is an expression here;
+            // function bodies are optimized when the function is built.
+            if (args.size() != 2 || !Is<Symbol>(args[0])) {
+                return form;
+            }
+            return Rebuild(form, &args, 1);
+        }
+        if (!EvaluatesArguments(function.get())) {
+            return form;
+        }
+        auto rebuilt = Rebuild(form, &args, 0);
+        // Builtins are the only functions with counters.
+        if (!function->GetBuiltinStats() || !function->IsPure() ||
+            !std::all_of(args.begin(), args.end(), IsConstant)) {
+            return rebuilt;
+        }
+        // Arguments which make the call fail are left for the failure to
+        // happen when the code runs. The program never makes the call, so it
+        // isn't counted.
+        try {
+            Metrics::Pause pause;
+            auto value = function->Execute(As<Cell>(rebuilt)->GetSecond(), scope_);
+            if (!IsConstant(value)) {
+                return rebuilt;
+            }
+            Fold(name, function);
+            return value;
+        } catch (const std::runtime_error&) {
+            return rebuilt;
+        }
+    }
+
+    std::shared_ptr<Object> OptimizeIf(const std::shared_ptr<Object>& form,
+                                       std::vector<std::shared_ptr<Object>> args,
+                                       const std::shared_ptr<Symbol>& name,
+                                       const std::shared_ptr<IFunction>& function) {
+        if (args.size() != 2 && args.size() != 3) {
+            return form;
+        }
+        auto rebuilt = Rebuild(form, &args, 0);
+        if (!IsConstant(args[0])) {
+            return rebuilt;
+        }
+        // Without an alternative the result is the empty list, which has no
+        // expression of its own.
+        if (IsFalse(args[0]) && args.size() == 2) {
+            return rebuilt;
+        }
+        Fold(name, function);
+        return IsFalse(args[0]) ? args[2] : args[1];
+    }
+
+    void Fold(const std::shared_ptr<Symbol>& name, const std::shared_ptr<IFunction>& function) {
+        if (folded_ && std::none_of(folded_->begin(), folded_->end(),
+                                    [&](const auto& call) { return call.first == name.get(); })) {
+            folded_->emplace_back(name.get(), function);
+        }
+    }
+
+    // Optimizes the arguments from `first` on and returns the form with them,
+    // the form itself if none of them changed.
+    std::shared_ptr<Object> Rebuild(const std::shared_ptr<Object>& form,
+                                    std::vector<std::shared_ptr<Object>>* args, size_t first) {
+        bool is_changed = false;
+        for (size_t i = first; i < args->size(); ++i) {
+            auto optimized = OptimizeExpression((*args)[i]);
+            is_changed |= optimized != (*args)[i];
+            (*args)[i] = std::move(optimized);
+        }
+        if (!is_changed) {
+            return form;
+        }
+        std::shared_ptr<Object> list;
+        for (auto it = args->rbegin(); it != args->rend(); ++it) {
+            list = GetHeap().Make<Cell>(*it, list);
+        }
+        return GetHeap().Make<Cell>(As<Cell>(form)->GetFirst(), list);
+    }
+
+    std::shared_ptr<Scope> scope_;
+    Names defined_;
+    FoldedCalls* folded_;
+};
+
+}  // namespace
+
+std::shared_ptr<Object> Optimize(const std::shared_ptr<Object>& form,
+                                 const std::shared_ptr<Scope>& scope) {
+    Names defined;
+    CollectDefinitions(form, &defined);
+    return Optimizer(scope, std::move(defined)).Run(form);
+}
+
+std::vector<std::shared_ptr<Object>> OptimizeBody(
+    const std::vector<std::shared_ptr<Object>>& executables, const std::shared_ptr<Scope>& scope,
+    FoldedCalls* folded) {
+    Names defined;
+    for (const auto& form : executables) {
+        CollectDefinitions(form, &defined);
+    }
+    Optimizer optimizer(scope, std::move(defined), folded);
+    std::vector<std::shared_ptr<Object>> optimized;
+    optimized.reserve(executables.size());
+    for (const auto& form : executables) {
+        optimized.push_back(optimizer.Run(form));
+    }
+    return optimized;
+}
+
+void SetOptimizerDump(std::ostream* out) {
+    dump_stream.store(out, std::memory_order_relaxed);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+class IFunction;
+class Object;
+class Scope;
+class Symbol;
+
+// Names whose calls the optimizer folded or pruned, each with the function it
+// resolved to at the time.
+using FoldedCalls = std::vector<std::pair<const Symbol*, std::shared_ptr<IFunction>>>;
+
+// Folds calls of pure builtins with constant arguments, prunes `if` branches
+// with a constant condition and replaces quoted constants with themselves.
+// Builtins are recognised by what their names resolve to in `scope`; names the
+// form itself defines are left alone. Changed forms are rebuilt, so the
+// original is never modified.
+std::shared_ptr<Object> Optimize(const std::shared_ptr<Object>& form,
+                                 const std::shared_ptr<Scope>& scope);
+
+// The same for a function body run in a frame on top of `scope`. The result
+// holds only while every name in `folded` resolves to the same function.
+std::vector<std::shared_ptr<Object>> OptimizeBody(
+    const std::vector<std::shared_ptr<Object>>& executables, const std::shared_ptr<Scope>& scope,
+    FoldedCalls* folded);
+
+// Writes every form the optimizer changes to `out` together with its original,
+// or stops if `out` is null.
+void SetOptimizerDump(std::ostream* out);
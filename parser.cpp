@@ -1,79 +1,142 @@
 #include "parser.h"
+
+#include <optional>
+#include <vector>
+
 #include "error.h"
 
-void AddListElement(std::shared_ptr<Object>& vertex, std::shared_ptr<Object> son) {
-    if (vertex == nullptr) {
-        vertex = std::make_shared<Cell>(son, nullptr);
-        return;
-    }
-    AddListElement(As<Cell>(vertex)->GetSecond(), son);
+namespace {
+
+// A list, vector or quote opened by the reader and not finished yet.
+struct PendingForm {
+    bool is_quote = false;
+    bool is_vector = false;
+    std::vector<std::shared_ptr<Object>> elements = {};
+    std::shared_ptr<Object> head = nullptr;
+    Cell* tail = nullptr;
+    bool reading_tail = false;
+    bool has_tail = false;
+};
+
+bool IsBracket(const Token& token, BracketToken bracket) {
+    return std::holds_alternative<BracketToken>(token) && std::get<BracketToken>(token) == bracket;
 }
 
-void AddBadListElement(std::shared_ptr<Object>& vertex, std::shared_ptr<Object> son) {
-    if (vertex == nullptr) {
-        throw SyntaxError("Wrong syntax");
+void AddListElement(PendingForm* list, std::shared_ptr<Object> element) {
+    if (list->is_vector) {
+        list->elements.push_back(std::move(element));
+        return;
     }
-    if (As<Cell>(vertex)->GetSecond() == nullptr) {
-        vertex = std::make_shared<Cell>(As<Cell>(vertex)->GetFirst(), son);
+    if (list->reading_tail) {
+        if (!list->head) {
+            throw SyntaxError("Wrong syntax");
+        }
+        list->tail->GetSecond() = element;
+        list->reading_tail = false;
+        list->has_tail = true;
         return;
     }
-    AddBadListElement(As<Cell>(vertex)->GetSecond(), son);
+    auto cell = GetHeap().Make<Cell>(element, nullptr);
+    if (list->head) {
+        list->tail->GetSecond() = cell;
+    } else {
+        list->head = cell;
+    }
+    list->tail = cell.get();
 }
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
-    std::shared_ptr<Object> root = nullptr;
-    tokenizer->Next();
-    bool bad_list = false;
-    while (!(std::holds_alternative<BracketToken>(tokenizer->GetToken()) &&
-             std::get<BracketToken>(tokenizer->GetToken()) == BracketToken::CLOSE)) {
-        if (tokenizer->IsEnd()) {
-            throw SyntaxError("wrong syntax");
-        }
-        if (bad_list) {
-            throw SyntaxError("wrong syntax");
-        }
-        if (std::holds_alternative<DotToken>(tokenizer->GetToken())) {
-            tokenizer->Next();
-            AddBadListElement(root, Read(tokenizer));
-            if (tokenizer->IsEnd()) {
-                throw SyntaxError("wrong syntax");
-            }
-            bad_list = true;
-            continue;
+// Moves on to the next element of the innermost list. Returns the list if it
+// has been closed and nothing if an element has to be read first.
+std::optional<std::shared_ptr<Object>> ContinueList(Tokenizer* tokenizer,
+                                                    std::vector<PendingForm>* stack) {
+    auto& list = stack->back();
+    if (tokenizer->IsEnd()) {
+        throw SyntaxError("wrong syntax");
+    }
+    if (IsBracket(tokenizer->GetToken(), BracketToken::CLOSE)) {
+        tokenizer->Next();
+        std::shared_ptr<Object> head = std::move(list.head);
+        if (list.is_vector) {
+            head = GetHeap().Make<Vector>(std::move(list.elements));
         }
-
-        AddListElement(root, Read(tokenizer));
-        if (tokenizer->IsEnd()) {
+        stack->pop_back();
+        return head;
+    }
+    if (list.has_tail) {
+        throw SyntaxError("wrong syntax");
+    }
+    if (std::holds_alternative<DotToken>(tokenizer->GetToken())) {
+        if (list.is_vector) {
             throw SyntaxError("wrong syntax");
         }
+        tokenizer->Next();
+        list.reading_tail = true;
     }
-    tokenizer->Next();
-    return root;
+    return std::nullopt;
 }
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
+// Reads an atom, or opens a list, a vector or a quote and returns nothing.
+std::optional<std::shared_ptr<Object>> StartDatum(Tokenizer* tokenizer,
+                                                  std::vector<PendingForm>* stack) {
     if (tokenizer->IsEnd()) {
         throw SyntaxError("wrong syntax");
     }
-    if (std::holds_alternative<BracketToken>(tokenizer->GetToken()) &&
-        std::get<BracketToken>(tokenizer->GetToken()) == BracketToken::OPEN) {
-        return ReadList(tokenizer);
+    const auto& token = tokenizer->GetToken();
+    if (IsBracket(token, BracketToken::OPEN)) {
+        tokenizer->Next();
+        stack->emplace_back();
+        return ContinueList(tokenizer, stack);
+    }
+    if (IsBracket(token, BracketToken::VECTOR_OPEN)) {
+        tokenizer->Next();
+        stack->push_back({.is_vector = true});
+        return ContinueList(tokenizer, stack);
     }
-    if (std::holds_alternative<QuoteToken>(tokenizer->GetToken())) {
+    if (std::holds_alternative<QuoteToken>(token)) {
         tokenizer->Next();
-        return std::make_shared<Cell>(std::make_shared<Symbol>("quote"),
-                                      std::make_shared<Cell>(Read(tokenizer), nullptr));
+        stack->push_back({.is_quote = true});
+        return std::nullopt;
     }
-    std::shared_ptr<Object> root;
-    if (std::holds_alternative<ConstantToken>(tokenizer->GetToken())) {
-        root = std::make_shared<Number>(std::get<ConstantToken>(tokenizer->GetToken()).value);
+    std::shared_ptr<Object> atom;
+    if (std::holds_alternative<ConstantToken>(token)) {
+        atom = Number::Make(std::get<ConstantToken>(token).value);
+    } else if (std::holds_alternative<BigConstantToken>(token)) {
+        atom = Number::Make(BigInteger::Parse(std::get<BigConstantToken>(token).digits));
+    } else if (std::holds_alternative<StringToken>(token)) {
+        atom = GetHeap().Make<String>(std::get<StringToken>(token).value);
+    } else if (std::holds_alternative<SymbolToken>(token)) {
+        atom = Symbol::Intern(tokenizer->GetText());
     } else {
-        if (std::holds_alternative<SymbolToken>(tokenizer->GetToken())) {
-            root = std::make_shared<Symbol>(std::get<SymbolToken>(tokenizer->GetToken()).name);
-        } else {
-            throw SyntaxError("Wrong syntax");
-        }
+        throw SyntaxError("Wrong syntax");
     }
     tokenizer->Next();
-    return root;
-}
\ No newline at end of file
+    return atom;
+}
+
+}  // namespace
+
+// Lists are built front to back through a tail pointer, and nesting is kept on
+// an explicit stack, so neither long nor deep input recurses.
+std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
+    static const auto kQuote = Symbol::Intern("quote");
+    std::vector<PendingForm> stack;
+    while (true) {
+        auto datum = StartDatum(tokenizer, &stack);
+        while (datum) {
+            if (stack.empty()) {
+                return *datum;
+            }
+            auto& form = stack.back();
+            if (form.is_quote) {
+                datum = GetHeap().Make<Cell>(kQuote, GetHeap().Make<Cell>(*datum, nullptr));
+                stack.pop_back();
+                continue;
+            }
+            AddListElement(&form, *datum);
+            if (tokenizer->IsEnd()) {
+                throw SyntaxError("wrong syntax");
+            }
+            datum = ContinueList(tokenizer, &stack);
+        }
+    }
+}
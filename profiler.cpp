@@ -0,0 +1,127 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <mutex>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "object.h"
+
+namespace {
+
+const std::string kTopLevel = "(top-level)";
+const std::string kDropped = "(dropped)";
+
+void ThrowSystemError(const char* what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+}  // namespace
+
+Profiler::Profiler() : stack_(kMaxDepth), buffer_(kBufferSize) {
+}
+
+Profiler::~Profiler() {
+    Stop();
+}
+
+void Profiler::Start(std::chrono::microseconds interval) {
+    static std::once_flag handler_installed;
+    std::call_once(handler_installed, [] {
+        struct sigaction action = {};
+        action.sa_sigaction = HandleSignal;
+        action.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, nullptr)) {
+            ThrowSystemError("sigaction");
+        }
+    });
+    Stop();
+    sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_value.sival_ptr = this;
+    event._sigev_un._tid = gettid();
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer_)) {
+        ThrowSystemError("timer_create");
+    }
+    has_timer_ = true;
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(interval);
+    timespec period = {seconds.count(), (interval - seconds).count() * 1000};
+    itimerspec spec = {period, period};
+    if (timer_settime(timer_, 0, &spec, nullptr)) {
+        Stop();
+        ThrowSystemError("timer_settime");
+    }
+}
+
+void Profiler::Stop() {
+    if (has_timer_) {
+        timer_delete(timer_);
+        has_timer_ = false;
+    }
+}
+
+// Runs in the signal handler, interrupting the thread the stack belongs to, so
+// it may only read the stack and append to the preallocated buffer.
+void Profiler::TakeSample() {
+    size_t depth = depth_;
+    depth = std::min(depth, kMaxDepth);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    size_t size = buffer_size_;
+    if (size + depth + 1 > buffer_.size()) {
+        dropped_ = dropped_ + 1;
+        return;
+    }
+    std::copy_n(stack_.begin(), depth, buffer_.begin() + size);
+    buffer_[size + depth] = nullptr;
+    buffer_size_ = size + depth + 1;
+}
+
+// Ticks of a profiler started by another interpreter on this thread are ignored.
+void Profiler::HandleSignal(int, siginfo_t* info, void*) {
+    if (auto profiler = current_; profiler && info->si_value.sival_ptr == profiler) {
+        int saved_errno = errno;
+        profiler->TakeSample();
+        errno = saved_errno;
+    }
+}
+
+void Profiler::Collect() {
+    std::string stack = kTopLevel;
+    for (size_t i = 0; i < buffer_size_; ++i) {
+        if (auto name = buffer_[i]) {
+            stack += ';';
+            stack += name->GetName();
+        } else {
+            ++stacks_[stack];
+            stack = kTopLevel;
+        }
+    }
+    buffer_size_ = 0;
+    total_dropped_ += dropped_;
+    dropped_ = 0;
+}
+
+void Profiler::WriteCollapsed(std::ostream* out) {
+    for (const auto& [stack, count] : stacks_) {
+        *out << stack << ' ' << count << '\n';
+    }
+    if (total_dropped_) {
+        *out << kDropped << ' ' << total_dropped_ << '\n';
+    }
+}
+
+Profiler::Activation::Activation(Profiler* profiler) : profiler_(profiler), previous_(current_) {
+    current_ = profiler;
+}
+
+Profiler::Activation::~Activation() {
+    current_ = previous_;
+    if (profiler_) {
+        profiler_->Collect();
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class Symbol;
+
+// Sampling profiler of Scheme code. While a profiler is active on a thread,
+// calls of user functions keep a shadow stack of their names, and a timer
+// signal ticking on the thread's CPU time copies it into a preallocated buffer.
+class Profiler {
+public:
+    // Frames deeper than this are not recorded; samples keep the outermost ones.
+    static constexpr size_t kMaxDepth = 1024;
+    static constexpr size_t kBufferSize = 1 << 16;
+
+    Profiler();
+    ~Profiler();
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // Starts sampling the calling thread. Throws std::system_error if the timer
+    // can't be created.
+    void Start(std::chrono::microseconds interval);
+    void Stop();
+
+    // Adds the samples taken so far to the collapsed stacks. Must be called
+    // while the profiler isn't active, since the signal handler writes the buffer.
+    void Collect();
+    // Writes "outer;inner count" lines, the input format of flamegraph tools.
+    void WriteCollapsed(std::ostream* out);
+
+    static Profiler* Current() {
+        return current_;
+    }
+
+    // Makes the profiler record the calls made on this thread for as long as
+    // the activation is alive, and collects the samples once it ends. A null
+    // profiler records nothing.
+    class Activation {
+    public:
+        explicit Activation(Profiler* profiler);
+        ~Activation();
+        Activation(const Activation&) = delete;
+        Activation& operator=(const Activation&) = delete;
+
+    private:
+        Profiler* profiler_;
+        Profiler* previous_;
+    };
+
+    // Restores the shadow stack to its depth at construction, however the
+    // frames above it were left.
+    class StackGuard {
+    public:
+        StackGuard() : profiler_(current_), depth_(profiler_ ? profiler_->depth_ : 0) {
+        }
+        ~StackGuard() {
+            if (profiler_) {
+                profiler_->Truncate(depth_);
+            }
+        }
+        StackGuard(const StackGuard&) = delete;
+        StackGuard& operator=(const StackGuard&) = delete;
+
+    private:
+        Profiler* profiler_;
+        size_t depth_;
+    };
+
+    // The frame of one call of a user function.
+    class Frame : public StackGuard {
+    public:
+        explicit Frame(const Symbol* name) {
+            Push(name);
+        }
+        // A tail call reuses the frame of its caller.
+        void Replace(const Symbol* name) {
+            Pop();
+            Push(name);
+        }
+    };
+
+    static void Push(const Symbol* name) {
+        if (auto profiler = current_) {
+            if (profiler->depth_ < kMaxDepth) {
+                profiler->stack_[profiler->depth_] = name;
+            }
+            // The handler must never see the new depth before the new name.
+            std::atomic_signal_fence(std::memory_order_release);
+            profiler->depth_ = profiler->depth_ + 1;
+        }
+    }
+    static void Pop() {
+        if (auto profiler = current_) {
+            profiler->depth_ = profiler->depth_ - 1;
+        }
+    }
+
+private:
+    static void HandleSignal(int, siginfo_t* info, void*);
+    void TakeSample();
+    void Truncate(size_t depth) {
+        depth_ = depth;
+    }
+
+    inline static thread_local Profiler* current_ = nullptr;
+
+    std::vector<const Symbol*> stack_;
+    volatile size_t depth_ = 0;
+    // Samples one after another, each ended by a null entry.
+    std::vector<const Symbol*> buffer_;
+    volatile size_t buffer_size_ = 0, dropped_ = 0;
+    std::map<std::string, size_t> stacks_;
+    size_t total_dropped_ = 0;
+    bool has_timer_ = false;
+    timer_t timer_;
+};
@@ -0,0 +1,162 @@
+#include "resolver.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "object.h"
+
+namespace {
+
+void AddSlot(FrameLayout* layout, const Symbol* name) {
+    if (layout->FindSlot(name) == LexicalAddress::kNoSlot) {
+        layout->slots.push_back(name);
+    }
+}
+
+// Variables defined by the body itself live in the frame. Nested lambdas and
+// function definitions get frames of their own and quoted data is never
+// evaluated, so neither is searched.
+void CollectDefinitions(std::shared_ptr<Object> form, FrameLayout* layout) {
+    static const auto kQuote = Symbol::Intern("quote");
+    static const auto kLambda = Symbol::Intern("lambda");
+    static const auto kDefine = Symbol::Intern("define");
+    if (!Is<Cell>(form)) {
+        return;
+    }
+    auto head = As<Cell>(form)->GetFirst();
+    if (head == kQuote || head == kLambda) {
+        return;
+    }
+    if (head == kDefine && Is<Cell>(As<Cell>(form)->GetSecond())) {
+        auto target = As<Cell>(As<Cell>(form)->GetSecond())->GetFirst();
+        if (!Is<Symbol>(target)) {
+            return;
+        }
+        AddSlot(layout, As<Symbol>(target).get());
+    }
+    while (Is<Cell>(form)) {
+        CollectDefinitions(As<Cell>(form)->GetFirst(), layout);
+        form = As<Cell>(form)->GetSecond();
+    }
+}
+
+// Only positions known to be evaluated in the frame are rewritten: the
+// arguments of functions which evaluate them, and of calls to functions not
+// defined yet. Quoted data, the arguments list and cons return, nested
+// function bodies and macro uses keep their symbols. A function defined as a
+// macro later gets the symbols back, see Cell::Expand.
+class Rewriter {
+public:
+    Rewriter(const FrameLayout& layout, const std::shared_ptr<Scope>& parent_scope)
+        : layout_(layout), parent_scope_(parent_scope) {
+    }
+
+    std::shared_ptr<Object> Rewrite(const std::shared_ptr<Object>& form) {
+        if (Is<Symbol>(form)) {
+            if (As<Symbol>(form)->IsBool()) {
+                return form;
+            }
+            return MakeReference(As<Symbol>(form));
+        }
+        if (!Is<Cell>(form)) {
+            return form;
+        }
+        auto head = As<Cell>(form)->GetFirst();
+        if (!Is<Symbol>(head)) {
+            return RewriteFrom(form, 0, 1);
+        }
+        auto function = parent_scope_->FindFunction(As<Symbol>(head).get());
+        // The target of set! is rewritten too, see SetFunction.
+        if (dynamic_cast<IfFunction*>(function.get()) ||
+            dynamic_cast<SetFunction*>(function.get())) {
+            return RewriteFrom(form, 1, SIZE_MAX);
+        }
+        if (dynamic_cast<DefineFunction*>(function.get())) {
+            auto rest = As<Cell>(form)->GetSecond();
+            return Is<Cell>(rest) && Is<Symbol>(As<Cell>(rest)->GetFirst())
+                       ? RewriteFrom(form, 2, SIZE_MAX)
+                       : form;
+        }
+        if (!function || EvaluatesArguments(function.get())) {
+            return RewriteFrom(form, 1, SIZE_MAX);
+        }
+        return form;
+    }
+
+private:
+    std::shared_ptr<Object> MakeReference(const std::shared_ptr<Symbol>& name) {
+        return GetHeap().Make<Reference>(name, Resolve(layout_, name.get(), parent_scope_));
+    }
+
+    // Rewrites the elements of a proper list from index `begin` to `end`, and
+    // returns the list itself if none of them changed.
+    std::shared_ptr<Object> RewriteFrom(const std::shared_ptr<Object>& form, size_t begin,
+                                        size_t end) {
+        std::vector<std::shared_ptr<Object>> elements;
+        auto rest = form;
+        for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+            elements.push_back(As<Cell>(rest)->GetFirst());
+        }
+        if (rest) {
+            return form;
+        }
+        bool is_changed = false;
+        for (auto i = begin; i < std::min(end, elements.size()); ++i) {
+            auto rewritten = Rewrite(elements[i]);
+            is_changed |= rewritten != elements[i];
+            elements[i] = std::move(rewritten);
+        }
+        if (!is_changed) {
+            return form;
+        }
+        std::shared_ptr<Object> list;
+        for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+            list = GetHeap().Make<Cell>(*it, list);
+        }
+        return list;
+    }
+
+    const FrameLayout& layout_;
+    const std::shared_ptr<Scope>& parent_scope_;
+};
+
+}  // namespace
+
+LexicalAddress Resolve(const FrameLayout& layout, const Symbol* name,
+                       const std::shared_ptr<Scope>& parent_scope) {
+    if (auto slot = layout.FindSlot(name); slot != LexicalAddress::kNoSlot) {
+        return {0, slot};
+    }
+    size_t depth = 1;
+    auto scope = parent_scope.get();
+    for (; scope->GetLayout(); scope = scope->GetParentScope().get(), ++depth) {
+        if (auto slot = scope->GetLayout()->FindSlot(name); slot != LexicalAddress::kNoSlot) {
+            return {depth, slot};
+        }
+    }
+    return {depth, LexicalAddress::kNoSlot};
+}
+
+size_t FrameLayout::FindSlot(const Symbol* name) const {
+    auto it = std::find(slots.begin(), slots.end(), name);
+    return it == slots.end() ? LexicalAddress::kNoSlot : it - slots.begin();
+}
+
+std::shared_ptr<const FrameLayout> ResolveFunction(
+    const std::vector<std::shared_ptr<Symbol>>& args,
+    std::vector<std::shared_ptr<Object>>* executables,
+    const std::shared_ptr<Scope>& parent_scope) {
+    auto layout = std::make_shared<FrameLayout>();
+    for (const auto& arg : args) {
+        AddSlot(layout.get(), arg.get());
+        layout->arg_slots.push_back(layout->FindSlot(arg.get()));
+    }
+    for (const auto& executable : *executables) {
+        CollectDefinitions(executable, layout.get());
+    }
+    Rewriter rewriter(*layout, parent_scope);
+    for (auto& executable : *executables) {
+        executable = rewriter.Rewrite(executable);
+    }
+    return layout;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class Object;
+class Scope;
+class Symbol;
+
+// Position of a variable relative to the frame that references it: the number
+// of parent hops and the slot in the frame reached. Names which are not bound
+// by any enclosing function frame have kNoSlot and are looked up by name
+// starting from the global scope reached after `depth` hops.
+struct LexicalAddress {
+    static constexpr size_t kNoSlot = static_cast<size_t>(-1);
+
+    size_t depth;
+    size_t slot;
+};
+
+// Static shape of a UserFunction frame: its parameters followed by the
+// variables defined directly in its body.
+struct FrameLayout {
+    size_t FindSlot(const Symbol* name) const;
+
+    std::vector<const Symbol*> slots;
+    std::vector<size_t> arg_slots;
+};
+
+// Lays out the frame of a function and rewrites every variable the body
+// evaluates into a Reference to its address, copying the cells on the way.
+std::shared_ptr<const FrameLayout> ResolveFunction(
+    const std::vector<std::shared_ptr<Symbol>>& args,
+    std::vector<std::shared_ptr<Object>>* executables,
+    const std::shared_ptr<Scope>& parent_scope);
+
+// The address of `name` in a frame with `layout` whose parent is `parent_scope`.
+LexicalAddress Resolve(const FrameLayout& layout, const Symbol* name,
+                       const std::shared_ptr<Scope>& parent_scope);
@@ -1,59 +1,89 @@
 #include "scheme.h"
 #include "parser.h"
+
 #include <sstream>
 
-std::string Interpreter::Run(const std::string& input) {
-    visited_.clear();
-    std::stringstream in;
-    in << input;
-    Tokenizer tokenizer(&in);
-    std::string ans;
+Interpreter::~Interpreter() {
+    if (scope_) {
+        GetHeap().RemoveRoot(scope_.get());
+        scope_.reset();
+        GetHeap().Collect();
+    }
+}
+
+std::string Interpreter::Run(std::string_view input) {
+    Tokenizer tokenizer(input);
     auto root = Read(&tokenizer);
     while (!tokenizer.IsEnd()) {
         Read(&tokenizer);
     }
+    return RunForm(root);
+}
+
+std::vector<std::string> Interpreter::RunAll(std::string_view input) {
+    std::vector<std::string> results;
+    RunAll(input, [&results](const std::string& result) { results.push_back(result); });
+    return results;
+}
+
+void Interpreter::RunAll(std::string_view input,
+                         const std::function<void(const std::string&)>& sink) {
+    Tokenizer tokenizer(input);
+    while (!tokenizer.IsEnd()) {
+        sink(RunForm(Read(&tokenizer)));
+    }
+}
+
+std::string Interpreter::RunForm(std::shared_ptr<Object> root) {
+    Metrics::RunTimer timer;
+    Profiler::Activation profiler_activation(profiler_.get());
+    Heap::RootGuard root_guard(root.get());
+    if (GetHeap().NeedsCollection()) {
+        GetHeap().Collect();
+    }
     if (scope_ == nullptr) {
-        scope_ = std::make_shared<Scope>();
+        scope_ = GetHeap().Make<Scope>();
         scope_->CreateGlobalScope();
+        GetHeap().AddRoot(scope_.get());
+    }
+    auto form = Optimize(root, scope_);
+    Heap::RootGuard form_guard(form.get());
+    if (engine_ == Engine::BYTECODE) {
+        Vm::Activation activation(&vm_);
+        return Serialize(vm_.Run(Compile({form}, nullptr, scope_), scope_));
+    }
+    return Serialize(Evaluate(form, scope_));
+}
+
+void Interpreter::SetEngine(Engine engine) {
+    engine_ = engine;
+}
+
+void Interpreter::SetSerializeOptions(const SerializeOptions& options) {
+    serialize_options_ = options;
+}
+
+void Interpreter::StartProfiling(std::chrono::microseconds interval) {
+    if (!profiler_) {
+        profiler_ = std::make_unique<Profiler>();
+    }
+    profiler_->Start(interval);
+}
+
+void Interpreter::StopProfiling() {
+    if (profiler_) {
+        profiler_->Stop();
+    }
+}
+
+void Interpreter::WriteProfile(std::ostream* out) {
+    if (profiler_) {
+        profiler_->WriteCollapsed(out);
     }
-    return Serialize(Evaluate(root, scope_));
 }
 
 std::string Interpreter::Serialize(std::shared_ptr<Object> object) {
-    if (visited_.contains(object)) {
-        return "(...)";
-    }
-    visited_.insert(object);
-    if (!object) {
-        return "()";
-    }
-    if (Is<Number>(object)) {
-        return std::to_string(As<Number>(object)->GetValue());
-    }
-    if (Is<Symbol>(object)) {
-        return As<Symbol>(object)->GetName();
-    }
-    std::string ans;
-    ans += "(";
-    while (object && Is<Cell>(object)) {
-        ans += Serialize(As<Cell>(object)->GetFirst());
-        object = As<Cell>(object)->GetSecond();
-        if (object) {
-            ans += " ";
-        }
-        if (Is<Cell>(object)) {
-            if (visited_.contains(object)) {
-                object = nullptr;
-                ans += "(...)";
-                break;
-            }
-            visited_.insert(object);
-        }
-    }
-    if (object) {
-        ans += ". " + Serialize(object);
-    }
-    ans += ")";
-
-    return ans;
+    std::ostringstream out;
+    ::Serialize(object, &out, serialize_options_);
+    return std::move(out).str();
 }
@@ -1,16 +1,44 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <ostream>
 #include <string>
-#include <set>
+#include <string_view>
+#include <vector>
 
 #include "object.h"
+#include "profiler.h"
+#include "serializer.h"
+#include "vm.h"
+
+enum class Engine { TREE_WALKER, BYTECODE };
 
 class Interpreter {
 public:
-    std::string Run(const std::string& input);
+    ~Interpreter();
+    std::string Run(std::string_view input);
+    // Evaluates every form of the input in order and returns their results.
+    std::vector<std::string> RunAll(std::string_view input);
+    // The same, passing each result to `sink` as soon as its form is evaluated.
+    // Forms before a failing one have been evaluated and reported.
+    void RunAll(std::string_view input, const std::function<void(const std::string&)>& sink);
+    void SetEngine(Engine engine);
+    void SetSerializeOptions(const SerializeOptions& options);
+    // Samples the Scheme call stack every `interval` of the calling thread's CPU
+    // time until StopProfiling. Samples are kept across restarts.
+    void StartProfiling(std::chrono::microseconds interval = std::chrono::milliseconds(1));
+    void StopProfiling();
+    // Writes the samples as collapsed stacks, as read by flamegraph.pl.
+    void WriteProfile(std::ostream* out);
 
 private:
+    std::string RunForm(std::shared_ptr<Object> root);
     std::string Serialize(std::shared_ptr<Object> object);
+    Engine engine_ = Engine::TREE_WALKER;
+    Vm vm_;
     std::shared_ptr<Scope> scope_;
-    std::set<std::shared_ptr<Object>> visited_;
+    SerializeOptions serialize_options_;
+    std::unique_ptr<Profiler> profiler_;
 };
@@ -0,0 +1,227 @@
+#include "serializer.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+class Serializer {
+public:
+    Serializer(std::ostream* out, const SerializeOptions& options)
+        : out_(out), options_(options) {
+    }
+
+    void Write(std::shared_ptr<Object> object) {
+        root_ = object.get();
+        if (options_.datum_labels) {
+            CountReferences(object);
+        }
+        WriteDatum(std::move(object));
+        while (!pending_.empty()) {
+            auto [object, index] = std::move(pending_.back());
+            pending_.pop_back();
+            if (Is<Vector>(object)) {
+                WriteElement(object, index);
+            } else if (object) {
+                WriteRest(object);
+            } else {
+                *out_ << ')';
+            }
+        }
+    }
+
+private:
+    // Finds aliased objects reachable more than once; they are the ones that
+    // need labels.
+    void CountReferences(std::shared_ptr<Object> object) {
+        std::vector<std::shared_ptr<Object>> stack{std::move(object)};
+        while (!stack.empty()) {
+            object = std::move(stack.back());
+            stack.pop_back();
+            if (IsTracked(object) && ++references_[object.get()] > 1) {
+                continue;
+            }
+            if (Is<Cell>(object)) {
+                stack.push_back(As<Cell>(object)->GetSecond());
+                stack.push_back(As<Cell>(object)->GetFirst());
+            } else if (Is<Vector>(object)) {
+                const auto& elements = As<Vector>(object)->GetElements();
+                stack.insert(stack.end(), elements.rbegin(), elements.rend());
+            }
+        }
+    }
+
+    // Apart from the root, an object can only be reached a second time through
+    // a reference stored by set-car!, set-cdr! or a vector builtin.
+    bool IsTracked(const std::shared_ptr<Object>& object) const {
+        return object && (object->IsAliased() || object.get() == root_) && !Is<Number>(object) &&
+               !Is<Symbol>(object);
+    }
+
+    bool IsShared(const std::shared_ptr<Object>& object) const {
+        auto it = references_.find(object.get());
+        return it != references_.end() && it->second > 1;
+    }
+
+    // Writes a label for an object reachable more than once. Returns true if
+    // the object has been written before and the reference is all there is to
+    // write.
+    bool WriteLabel(const std::shared_ptr<Object>& object) {
+        if (!IsTracked(object)) {
+            return false;
+        }
+        if (!options_.datum_labels) {
+            if (visited_.insert(object.get()).second) {
+                return false;
+            }
+            *out_ << "(...)";
+            return true;
+        }
+        if (!IsShared(object)) {
+            return false;
+        }
+        auto [label, inserted] = labels_.emplace(object.get(), labels_.size());
+        *out_ << '#' << label->second << (inserted ? '=' : '#');
+        return !inserted;
+    }
+
+    // Writes an object down to the first element of every list it starts;
+    // the rest of each list is left on the pending stack.
+    void WriteDatum(std::shared_ptr<Object> object) {
+        while (true) {
+            if (WriteLabel(object)) {
+                return;
+            }
+            if (!object) {
+                *out_ << "()";
+                return;
+            }
+            if (Is<Number>(object)) {
+                auto number = As<Number>(object);
+                if (number->IsFixnum()) {
+                    *out_ << number->GetValue();
+                } else {
+                    *out_ << number->ToString();
+                }
+                return;
+            }
+            if (Is<Symbol>(object)) {
+                *out_ << As<Symbol>(object)->GetName();
+                return;
+            }
+            if (Is<Reference>(object)) {
+                *out_ << As<Reference>(object)->GetName()->GetName();
+                return;
+            }
+            if (Is<Vector>(object)) {
+                *out_ << "#(";
+                pending_.push_back({object, 0});
+                return;
+            }
+            if (Is<String>(object)) {
+                WriteString(As<String>(object)->GetValue());
+                return;
+            }
+            if (Is<HashTable>(object)) {
+                *out_ << "#<hash-table>";
+                return;
+            }
+            if (Is<StringPort>(object)) {
+                *out_ << "#<string-port>";
+                return;
+            }
+            if (!Is<Cell>(object)) {
+                *out_ << (options_.datum_labels ? "#<procedure>" : "(. (...))");
+                return;
+            }
+            *out_ << '(';
+            pending_.push_back({object});
+            object = As<Cell>(object)->GetFirst();
+        }
+    }
+
+    // Continues a list after the first element of `cell` has been written.
+    void WriteRest(const std::shared_ptr<Object>& cell) {
+        auto rest = As<Cell>(cell)->GetSecond();
+        if (!rest) {
+            *out_ << ')';
+            return;
+        }
+        if (!options_.datum_labels) {
+            *out_ << ' ';
+            if (Is<Cell>(rest)) {
+                if (WriteLabel(rest)) {
+                    *out_ << ')';
+                    return;
+                }
+                pending_.push_back({rest});
+                WriteDatum(As<Cell>(rest)->GetFirst());
+                return;
+            }
+            *out_ << ". ";
+        } else if (Is<Cell>(rest) && !IsShared(rest)) {
+            *out_ << ' ';
+            pending_.push_back({rest});
+            WriteDatum(As<Cell>(rest)->GetFirst());
+            return;
+        } else {
+            *out_ << " . ";
+        }
+        pending_.push_back({nullptr});
+        WriteDatum(rest);
+    }
+
+    // Writes a string literal the tokenizer reads back as the same string.
+    void WriteString(const std::string& value) {
+        *out_ << '"';
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                *out_ << '\\' << c;
+            } else if (c == '\n') {
+                *out_ << "\\n";
+            } else if (c == '\t') {
+                *out_ << "\\t";
+            } else {
+                *out_ << c;
+            }
+        }
+        *out_ << '"';
+    }
+
+    // Writes the element of a vector at `index`, or closes the vector.
+    void WriteElement(const std::shared_ptr<Object>& vector, size_t index) {
+        const auto& elements = As<Vector>(vector)->GetElements();
+        if (index == elements.size()) {
+            *out_ << ')';
+            return;
+        }
+        if (index > 0) {
+            *out_ << ' ';
+        }
+        pending_.push_back({vector, index + 1});
+        WriteDatum(elements[index]);
+    }
+
+    std::ostream* out_;
+    SerializeOptions options_;
+    const Object* root_ = nullptr;
+    // Lists and vectors with elements left to write; nullptr stands for a
+    // closing bracket.
+    struct Pending {
+        std::shared_ptr<Object> object;
+        // The next element of a vector.
+        size_t index = 0;
+    };
+
+    std::vector<Pending> pending_;
+    std::unordered_set<const Object*> visited_;
+    std::unordered_map<const Object*, size_t> references_, labels_;
+};
+
+}  // namespace
+
+void Serialize(const std::shared_ptr<Object>& object, std::ostream* out,
+               const SerializeOptions& options) {
+    Serializer(out, options).Write(object);
+}
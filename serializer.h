@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+
+#include "object.h"
+
+struct SerializeOptions {
+    // Print shared and circular structure with SRFI-38 labels, e.g.
+    // #0=(1 . #0#), instead of cutting repeated objects off with (...).
+    bool datum_labels = false;
+};
+
+// Writes the external representation of an object. Nesting is handled with an
+// explicit stack, and only the root and aliased objects are looked up in hash
+// tables.
+void Serialize(const std::shared_ptr<Object>& object, std::ostream* out,
+               const SerializeOptions& options = {});
@@ -1,7 +1,47 @@
 #include "tokenizer.h"
-#include <cctype>
+#include <array>
+#include <charconv>
+#include <cstdint>
 #include "error.h"
 
+namespace {
+
+enum CharClass : uint8_t {
+    kSpace = 1,
+    kDigit = 2,
+    kBeginSymbol = 4,
+    kSymbol = 8,
+};
+
+constexpr auto kCharClasses = [] {
+    std::array<uint8_t, 256> classes{};
+    for (unsigned char c : std::string_view(" \t\n\v\f\r")) {
+        classes[c] |= kSpace;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        classes[c] |= kDigit | kSymbol;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        classes[c] |= kBeginSymbol | kSymbol;
+        classes[c - 'a' + 'A'] |= kBeginSymbol | kSymbol;
+    }
+    for (unsigned char c : std::string_view("<=>*/#_")) {
+        classes[c] |= kBeginSymbol | kSymbol;
+    }
+    for (unsigned char c : std::string_view("?!-")) {
+        classes[c] |= kSymbol;
+    }
+    return classes;
+}();
+
+// Takes the result of istream::peek(), so EOF belongs to no class.
+bool HasClass(int c, CharClass char_class) {
+    return c != std::char_traits<char>::eof() &&
+           (kCharClasses[static_cast<unsigned char>(c)] & char_class);
+}
+
+}  // namespace
+
 bool SymbolToken::operator==(const SymbolToken &other) const {
     return name == other.name;
 }
@@ -18,84 +58,210 @@ bool ConstantToken::operator==(const ConstantToken &other) const {
     return value == other.value;
 }
 
+bool BigConstantToken::operator==(const BigConstantToken &other) const {
+    return digits == other.digits;
+}
+
+bool StringToken::operator==(const StringToken &other) const {
+    return value == other.value;
+}
+
 Tokenizer::Tokenizer(std::istream *in) {
     current_stream_ = in;
     Next();
 }
 
+Tokenizer::Tokenizer(std::string_view buffer) : buffer_(buffer) {
+    Next();
+}
+
 bool Tokenizer::IsEnd() {
     return is_eof_;
 }
 
-Token Tokenizer::GetToken() {
+const Token &Tokenizer::GetToken() {
     return current_token_;
 }
 
+std::string_view Tokenizer::GetText() {
+    return text_;
+}
+
 void Tokenizer::Next() {
     if (IsEnd()) {
         return;
     }
-    std::string buf;
+    if (current_stream_) {
+        NextFromStream();
+    } else {
+        NextFromBuffer();
+    }
+}
+
+void Tokenizer::NextFromStream() {
+    std::string &buf = stream_text_;
+    buf.clear();
     SkipSpaces();
     buf += current_stream_->get();
     if (current_stream_->eof()) {
         is_eof_ = true;
         return;
     }
-    if (buf.back() == '.') {
-        current_token_ = DotToken();
+    char first = buf.back();
+    if ((first == '+' || first == '-') && !HasClass(current_stream_->peek(), kDigit)) {
+        SetToken(first, buf);
         return;
     }
-    if (buf.back() == '\'') {
-        current_token_ = QuoteToken();
-        return;
+    if (first == '"') {
+        // The closing quote is checked for when the token is classified.
+        for (bool is_escaped = false; current_stream_->peek() != std::char_traits<char>::eof();) {
+            buf += current_stream_->get();
+            if (!is_escaped && buf.back() == '"') {
+                break;
+            }
+            is_escaped = !is_escaped && buf.back() == '\\';
+        }
+    } else if (first == '#' && current_stream_->peek() == '(') {
+        buf += current_stream_->get();
+    } else if (first == '.') {
+        while (current_stream_->peek() == '.') {
+            buf += current_stream_->get();
+        }
+    } else if (IsBeginSymbol(first)) {
+        while (IsSymbol(current_stream_->peek())) {
+            buf += current_stream_->get();
+        }
+    } else if (HasClass(first, kDigit) || first == '+' || first == '-') {
+        while (HasClass(current_stream_->peek(), kDigit)) {
+            buf += current_stream_->get();
+        }
     }
-    if (buf.back() == '(') {
-        current_token_ = BracketToken::OPEN;
-        return;
+    SetToken(first, buf);
+}
+
+void Tokenizer::NextFromBuffer() {
+    size_t pos = 0;
+    while (pos < buffer_.size() && HasClass(buffer_[pos], kSpace)) {
+        ++pos;
     }
-    if (buf.back() == ')') {
-        current_token_ = BracketToken::CLOSE;
+    if (pos == buffer_.size()) {
+        buffer_ = {};
+        is_eof_ = true;
         return;
     }
-    bool is_symbol = false;
-    if ((buf.back() == '+' || buf.back() == '-') && !std::isdigit(current_stream_->peek())) {
-        current_token_ = SymbolToken();
-        get<SymbolToken>(current_token_).name = buf;
-        return;
+    char first = buffer_[pos];
+    size_t end = pos + 1;
+    auto next_is_digit = [&] { return end < buffer_.size() && HasClass(buffer_[end], kDigit); };
+    if ((first == '+' || first == '-') && !next_is_digit()) {
+        // A lone sign is a symbol.
+    } else if (first == '"') {
+        for (bool is_escaped = false; end < buffer_.size();) {
+            char c = buffer_[end++];
+            if (!is_escaped && c == '"') {
+                break;
+            }
+            is_escaped = !is_escaped && c == '\\';
+        }
+    } else if (first == '#' && end < buffer_.size() && buffer_[end] == '(') {
+        ++end;
+    } else if (first == '.') {
+        while (end < buffer_.size() && buffer_[end] == '.') {
+            ++end;
+        }
+    } else if (IsBeginSymbol(first)) {
+        while (end < buffer_.size() && IsSymbol(buffer_[end])) {
+            ++end;
+        }
+    } else if (HasClass(first, kDigit) || first == '+' || first == '-') {
+        while (next_is_digit()) {
+            ++end;
+        }
     }
-    if (!IsBeginSymbol(buf.back()) && !std::isdigit(buf.back()) && buf.back() != '+' &&
-        buf.back() != '-') {
+    auto text = buffer_.substr(pos, end - pos);
+    buffer_.remove_prefix(end);
+    SetToken(first, text);
+}
+
+// Classifies a token whose text has already been scanned.
+void Tokenizer::SetToken(char first, std::string_view text) {
+    text_ = text;
+    if (text == ".") {
+        current_token_ = DotToken();
+    } else if (text == "...") {
+        // The ellipsis of syntax-rules patterns.
+        current_token_ = SymbolToken{std::string(text)};
+    } else if (first == '\'') {
+        current_token_ = QuoteToken();
+    } else if (first == '(') {
+        current_token_ = BracketToken::OPEN;
+    } else if (first == ')') {
+        current_token_ = BracketToken::CLOSE;
+    } else if (first == '"') {
+        SetString(text);
+    } else if (text == "#(") {
+        current_token_ = BracketToken::VECTOR_OPEN;
+    } else if (IsBeginSymbol(first) || ((first == '+' || first == '-') && text.size() == 1)) {
+        if (!std::holds_alternative<SymbolToken>(current_token_)) {
+            current_token_ = SymbolToken();
+        }
+        std::get<SymbolToken>(current_token_).name.assign(text);
+    } else if (HasClass(first, kDigit) || first == '+' || first == '-') {
+        auto digits = text.substr(first == '+' ? 1 : 0);
+        int64_t value;
+        auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+        if (error == std::errc::result_out_of_range) {
+            current_token_ = BigConstantToken{std::string(digits.substr(0, end - digits.data()))};
+        } else {
+            current_token_ = ConstantToken{value};
+        }
+    } else {
         throw SyntaxError("Wrong syntax");
     }
-    if (IsBeginSymbol(buf.back())) {
-        is_symbol = true;
-    }
-    if (is_symbol) {
-        while (IsSymbol(current_stream_->peek())) {
-            buf += current_stream_->get();
+}
+
+// Supports the \\, \", \n and \t escapes.
+void Tokenizer::SetString(std::string_view text) {
+    std::string value;
+    size_t i = 1;
+    for (; i < text.size() && text[i] != '"'; ++i) {
+        if (text[i] != '\\') {
+            value += text[i];
+            continue;
         }
-        current_token_ = SymbolToken();
-        get<SymbolToken>(current_token_).name = buf;
-    } else {
-        while (std::isdigit(current_stream_->peek())) {
-            buf += current_stream_->get();
+        if (++i == text.size()) {
+            break;
+        }
+        switch (text[i]) {
+            case 'n':
+                value += '\n';
+                break;
+            case 't':
+                value += '\t';
+                break;
+            case '"':
+            case '\\':
+                value += text[i];
+                break;
+            default:
+                throw SyntaxError("Wrong escape in string");
         }
-        current_token_ = ConstantToken();
-        get<ConstantToken>(current_token_).value = std::stoi(buf);
     }
+    if (i + 1 != text.size()) {
+        throw SyntaxError("Unterminated string");
+    }
+    current_token_ = StringToken{std::move(value)};
 }
 
 void Tokenizer::SkipSpaces() {
-    while (std::isspace(current_stream_->peek())) {
+    while (HasClass(current_stream_->peek(), kSpace)) {
         current_stream_->get();
     }
 }
 
-bool Tokenizer::IsBeginSymbol(char c) {
-    return std::isalpha(c) || c == '<' || c == '=' || c == '>' || c == '*' || c == '/' || c == '#';
+bool Tokenizer::IsBeginSymbol(int c) {
+    return HasClass(c, kBeginSymbol);
 }
 
-bool Tokenizer::IsSymbol(char c) {
-    return IsBeginSymbol(c) || std::isdigit(c) || c == '?' || c == '!' || c == '-';
-}
\ No newline at end of file
+bool Tokenizer::IsSymbol(int c) {
+    return HasClass(c, kSymbol);
+}
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <variant>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <istream>
 
 struct SymbolToken {
@@ -19,31 +21,59 @@ struct DotToken {
     bool operator==(const DotToken&) const;
 };
 
-enum class BracketToken { OPEN, CLOSE };
+// VECTOR_OPEN is "#(", which starts a vector literal.
+enum class BracketToken { OPEN, CLOSE, VECTOR_OPEN };
 
 struct ConstantToken {
-    int value;
+    int64_t value;
 
     bool operator==(const ConstantToken& other) const;
 };
 
-using Token = std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken>;
+// An integer literal which doesn't fit into int64_t, with its sign.
+struct BigConstantToken {
+    std::string digits;
+
+    bool operator==(const BigConstantToken& other) const;
+};
+
+// A string literal with its escapes resolved.
+struct StringToken {
+    std::string value;
+
+    bool operator==(const StringToken& other) const;
+};
+
+using Token = std::variant<ConstantToken, BigConstantToken, BracketToken, SymbolToken, QuoteToken,
+                           DotToken, StringToken>;
 
 class Tokenizer {
 public:
     Tokenizer(std::istream* in);
 
+    // Scans the buffer in place, which must outlive the tokenizer.
+    explicit Tokenizer(std::string_view buffer);
+
     bool IsEnd();
 
     void Next();
 
-    Token GetToken();
+    const Token& GetToken();
+
+    // Source text of the current token. In buffer mode it points into the buffer.
+    std::string_view GetText();
 
 private:
+    void NextFromStream();
+    void NextFromBuffer();
+    void SetToken(char first, std::string_view text);
+    void SetString(std::string_view text);
     void SkipSpaces();
-    bool IsBeginSymbol(char c);
-    bool IsSymbol(char c);
+    bool IsBeginSymbol(int c);
+    bool IsSymbol(int c);
     bool is_eof_ = false;
     Token current_token_;
-    std::istream* current_stream_;
+    std::istream* current_stream_ = nullptr;
+    std::string stream_text_;
+    std::string_view buffer_, text_;
 };
\ No newline at end of file
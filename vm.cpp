@@ -0,0 +1,271 @@
+#include "vm.h"
+
+#include "profiler.h"
+
+namespace {
+
+thread_local Vm* current_vm = nullptr;
+
+// Calls a function with the argument forms left unevaluated, exactly as
+// Scope::CallFunction does.
+std::shared_ptr<Object> CallWithForms(const std::shared_ptr<IFunction>& func,
+                                      const std::shared_ptr<Object>& args,
+                                      std::shared_ptr<Scope> scope) {
+    if (args && args->object_scope) {
+        scope = args->object_scope;
+    }
+    Metrics::CallTimer timer(func->GetBuiltinStats());
+    return func->Execute(args, scope);
+}
+
+}  // namespace
+
+Vm::Activation::Activation(Vm* vm) : previous_(current_vm) {
+    current_vm = vm;
+}
+
+Vm::Activation::~Activation() {
+    current_vm = previous_;
+}
+
+Vm* Vm::Current() {
+    return current_vm;
+}
+
+void Vm::Trace(Heap* heap) {
+    for (const auto& frame : frames_) {
+        heap->Mark(frame.scope.get());
+        heap->Mark(frame.result_scope.get());
+        heap->Mark(frame.memoized.get());
+        for (const auto& arg : frame.memo_key) {
+            heap->Mark(arg.get());
+        }
+    }
+    for (const auto& value : stack_) {
+        heap->Mark(value.get());
+    }
+    for (const auto& callee : callees_) {
+        heap->Mark(callee.get());
+    }
+}
+
+void Vm::Push(std::shared_ptr<Object> value) {
+    stack_.push_back(std::move(value));
+}
+
+std::shared_ptr<Object> Vm::Pop() {
+    auto value = std::move(stack_.back());
+    stack_.pop_back();
+    return value;
+}
+
+std::shared_ptr<Object> Vm::Run(std::shared_ptr<const Chunk> chunk, std::shared_ptr<Scope> scope) {
+    Heap::RootGuard guard(this);
+    Profiler::StackGuard profiler_guard;
+    size_t depth = frames_.size(), stack_size = stack_.size(), callees = callees_.size();
+    frames_.push_back({std::move(chunk), 0, std::move(scope), nullptr, stack_size});
+    try {
+        return Loop(depth);
+    } catch (...) {
+        frames_.resize(depth);
+        stack_.resize(stack_size);
+        callees_.resize(callees);
+        throw;
+    }
+}
+
+std::shared_ptr<Scope> Vm::Enter(const std::shared_ptr<UserFunction>& callee, size_t argc) {
+    auto scope = callee->CreateFrame();
+    const auto& arg_slots = callee->GetLayout()->arg_slots;
+    size_t first = stack_.size() - argc;
+    for (size_t i = 0; i < argc; ++i) {
+        scope->SetSlot(arg_slots[i], std::move(stack_[first + i]));
+    }
+    stack_.resize(first);
+    return scope;
+}
+
+std::shared_ptr<Object> Vm::Loop(size_t depth) {
+    while (true) {
+        auto* frame = &frames_.back();
+        const auto& chunk = *frame->chunk;
+        auto [op, a, b, c] = chunk.code[frame->pc++];
+        switch (op) {
+            case OpCode::CONST:
+                Push(chunk.constants[a]);
+                break;
+            case OpCode::LOAD_LOCAL:
+            case OpCode::LOAD_GLOBAL: {
+                auto name = static_cast<const Symbol*>(chunk.constants[a].get());
+                auto scope = frame->scope.get();
+                if (scope->IsFunctionExists(name)) {
+                    Push(scope->GetFunction(name)->GetFunctionObject());
+                } else {
+                    size_t slot = op == OpCode::LOAD_LOCAL ? c : LexicalAddress::kNoSlot;
+                    Push(scope->GetVariable(name, {b, slot}));
+                }
+                break;
+            }
+            case OpCode::STORE_LOCAL:
+            case OpCode::STORE_GLOBAL: {
+                auto name = static_cast<const Symbol*>(chunk.constants[a].get());
+                size_t slot = op == OpCode::STORE_LOCAL ? c : LexicalAddress::kNoSlot;
+                stack_.back() = frame->scope->UpdateVariable(name, {b, slot}, stack_.back());
+                break;
+            }
+            case OpCode::POP:
+                stack_.pop_back();
+                break;
+            case OpCode::JUMP:
+                frame->pc = a;
+                break;
+            case OpCode::JUMP_IF_FALSE:
+                if (Pop() == Symbol::False()) {
+                    frame->pc = a;
+                }
+                break;
+            case OpCode::CHECK_NUMBER:
+                if (!Is<Number>(stack_.back())) {
+                    throw RuntimeError("Bad list");
+                }
+                break;
+            case OpCode::GUARD: {
+                auto cell = static_cast<Cell*>(chunk.constants[b].get());
+                if (cell->object_scope || cell->GetFirst() != chunk.constants[b + 1]) {
+                    frame->pc = c;
+                } else if (a != Chunk::kNoFunction) {
+                    if (cell->FindCallee(frame->scope.get()) != chunk.functions[a]) {
+                        frame->pc = c;
+                    }
+                }
+                break;
+            }
+            case OpCode::PREPARE_CALL: {
+                const auto& form = chunk.constants[a];
+                auto cell = static_cast<Cell*>(form.get());
+                auto scope = frame->scope;
+                if (cell->object_scope || cell->GetFirst() != chunk.constants[a + 1]) {
+                    Push(Evaluate(form, scope));
+                    frames_.back().pc = c;
+                    break;
+                }
+                auto func = cell->FindCallee(scope.get());
+                if (!func) {
+                    throw NameError("Unknown function: " + As<Symbol>(cell->GetFirst())->GetName());
+                }
+                // Evaluating the form expands it in place.
+                if (func->IsMacro()) {
+                    Push(Evaluate(form, scope));
+                    frames_.back().pc = c;
+                    break;
+                }
+                auto user = std::dynamic_pointer_cast<UserFunction>(func);
+                if (!user || (cell->GetSecond() && cell->GetSecond()->object_scope)) {
+                    Push(CallWithForms(func, cell->GetSecond(), scope));
+                    frames_.back().pc = c;
+                    break;
+                }
+                if (user->GetArgCount() != b) {
+                    throw RuntimeError("Invalid argument count");
+                }
+                callees_.push_back(std::move(user));
+                break;
+            }
+            case OpCode::PREPARE_VALUE_CALL: {
+                auto cell = static_cast<Cell*>(chunk.constants[a].get());
+                auto scope = frame->scope;
+                auto head = Pop();
+                while (!head || Is<Cell>(head)) {
+                    head = Evaluate(head, scope);
+                }
+                std::shared_ptr<UserFunction> user;
+                if (Is<FunctionObject>(head)) {
+                    user = std::dynamic_pointer_cast<UserFunction>(
+                        As<FunctionObject>(head)->GetFunction());
+                }
+                if (!user || (cell->GetSecond() && cell->GetSecond()->object_scope)) {
+                    Push(scope->CallFunction(head, cell->GetSecond(), scope));
+                    frames_.back().pc = c;
+                    break;
+                }
+                if (user->GetArgCount() != b) {
+                    throw RuntimeError("Invalid argument count");
+                }
+                callees_.push_back(std::move(user));
+                break;
+            }
+            case OpCode::CALL:
+            case OpCode::TAIL_CALL: {
+                GetHeap().CollectIfNeeded();
+                auto callee = std::move(callees_.back());
+                callees_.pop_back();
+                std::vector<std::shared_ptr<Object>> memo_key;
+                if (callee->IsMemoized()) {
+                    auto args = std::span(stack_).last(b);
+                    if (auto result = callee->FindMemoized(args)) {
+                        stack_.resize(stack_.size() - b);
+                        Push(std::move(result));
+                        break;
+                    }
+                    memo_key.assign(args.begin(), args.end());
+                }
+                auto scope = Enter(callee, b);
+                // A memoized call has to return to store its result, so it
+                // never replaces the frame.
+                if (op == OpCode::CALL || callee->IsMemoized()) {
+                    Profiler::Push(callee->GetName());
+                    auto memoized = callee->IsMemoized() ? std::move(callee) : nullptr;
+                    frames_.push_back({memoized ? memoized->GetChunk() : callee->GetChunk(), 0,
+                                       scope, scope, stack_.size(), std::move(memoized),
+                                       std::move(memo_key)});
+                    break;
+                }
+                Profiler::Pop();
+                Profiler::Push(callee->GetName());
+                stack_.resize(frame->base);
+                frame->chunk = callee->GetChunk();
+                frame->pc = 0;
+                frame->scope = std::move(scope);
+                break;
+            }
+            case OpCode::APPLY: {
+                Metrics::CallTimer timer(chunk.functions[a]->GetBuiltinStats());
+                auto args = std::span(stack_).last(b);
+                auto result = chunk.functions[a]->Apply(args);
+                stack_.resize(stack_.size() - b);
+                Push(std::move(result));
+                break;
+            }
+            case OpCode::MAKE_CLOSURE: {
+                const auto& closure = chunk.closures[a];
+                auto body =
+                    closure.source->PrepareBody(closure.args, closure.executables, frame->scope);
+                Push(GetHeap().Make<FunctionObject>(
+                    GetHeap().Make<UserFunction>(std::move(body), frame->scope)));
+                break;
+            }
+            case OpCode::EVAL: {
+                auto scope = frame->scope;
+                Push(Evaluate(chunk.constants[a], scope));
+                break;
+            }
+            case OpCode::RETURN: {
+                auto result = Pop();
+                if (frame->result_scope && Is<Cell>(result)) {
+                    result->object_scope = frame->result_scope;
+                }
+                if (frame->memoized) {
+                    frame->memoized->StoreMemoized(frame->memo_key, result);
+                }
+                stack_.resize(frame->base);
+                frames_.pop_back();
+                if (frames_.size() == depth) {
+                    return result;
+                }
+                Profiler::Pop();
+                Push(std::move(result));
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "compiler.h"
+
+// Stack machine running compiled chunks. Frames are ordinary scopes, so closures
+// and everything the compiler leaves to the tree walker work unchanged.
+class Vm : public HeapObject {
+public:
+    // While an activation is alive, user functions invoked by the tree walker run
+    // their bodies on this machine instead.
+    class Activation {
+    public:
+        explicit Activation(Vm* vm);
+        ~Activation();
+        Activation(const Activation&) = delete;
+        Activation& operator=(const Activation&) = delete;
+
+    private:
+        Vm* previous_;
+    };
+
+    static Vm* Current();
+
+    std::shared_ptr<Object> Run(std::shared_ptr<const Chunk> chunk, std::shared_ptr<Scope> scope);
+    void Trace(Heap* heap) override;
+
+private:
+    struct Frame {
+        std::shared_ptr<const Chunk> chunk;
+        size_t pc;
+        std::shared_ptr<Scope> scope;
+        // Scope stamped onto the returned value, as UserFunction::Execute does.
+        std::shared_ptr<Scope> result_scope;
+        size_t base;
+        // A memoized call stores its result under its arguments on return.
+        std::shared_ptr<UserFunction> memoized = nullptr;
+        std::vector<std::shared_ptr<Object>> memo_key = {};
+    };
+
+    std::shared_ptr<Object> Loop(size_t depth);
+    std::shared_ptr<Scope> Enter(const std::shared_ptr<UserFunction>& callee, size_t argc);
+    void Push(std::shared_ptr<Object> value);
+    std::shared_ptr<Object> Pop();
+
+    std::vector<Frame> frames_;
+    std::vector<std::shared_ptr<Object>> stack_;
+    std::vector<std::shared_ptr<UserFunction>> callees_;
+};